@@ -2,18 +2,38 @@
 #include <cstring>
 #include <cstdlib>
 #include <cstdio>
+#include <new>
 
+/** Decoding information for one part's channel values */
+struct BVH::ChannelMap {
+	int         count;			// Number of values per frame
+	signed char position[3];	// Value index of x,y,z position or -1
+	signed char rotation[3];	// Value index of each rotation in order applied
+	EulerFunc   euler;			// Fused rotation decoder, or null for the generic path
+};
 
-BVH::BVH() : m_root(0), m_parts(0), m_partCount(0) {
+
+BVH::BVH() : m_root(0), m_skeleton(0), m_parts(0), m_partCount(0), m_frames(0), m_frameTime(0), m_compressed(false),
+             m_blockBounds(0), m_channelMaps(0), m_source(0), m_frameIndex(0), m_rawMotion(false), m_blockState(0),
+             m_decodedFrames(0), m_streaming(false) {
 }
 
 BVH::~BVH() {
 	for(int i=0; i<m_partCount; ++i) {
-		delete [] m_parts[i]->name;
-		delete [] m_parts[i]->motion;
+		if(!m_skeleton) delete [] m_parts[i]->name;
+		if(m_rawMotion) ::operator delete[](m_parts[i]->motion);
+		else delete [] m_parts[i]->motion;
+		delete [] m_parts[i]->packed;
+		delete [] m_parts[i]->keyFrames;
 		delete m_parts[i];
 	}
 	delete [] m_parts;
+	delete [] m_blockBounds;
+	delete [] m_channelMaps;
+	delete [] m_frameIndex;
+	delete [] m_blockState;
+	free((void*)m_source);
+	if(m_skeleton) m_skeleton->release();
 }
 
 // -------------------------------------------------------------------------- //
@@ -49,10 +69,67 @@ inline bool readInt(const char*& data, int& out) {
 	else return false;
 }
 
+inline void expand(BVH::Bounds& b, const vec3& p) {
+	if(p.x < b.min.x) b.min.x = p.x;
+	if(p.y < b.min.y) b.min.y = p.y;
+	if(p.z < b.min.z) b.min.z = p.z;
+	if(p.x > b.max.x) b.max.x = p.x;
+	if(p.y > b.max.y) b.max.y = p.y;
+	if(p.z > b.max.z) b.max.z = p.z;
+}
+
 
 // -------------------------------------------------------------------------- //
 
-BVH::Part* BVH::readHeirachy(const char*& data) {
+/** Rotation of three axis rotations a*b*c about distinct axes A,B,C, from half angles.
+ * S is the sign of cross(A,B) along C: 1 for XYZ, YZX, ZXY, -1 otherwise */
+template<int A, int B, int C, int S>
+Quaternion eulerToQuaternion(float ha, float hb, float hc) {
+	float sa = sinf(ha), ca = cosf(ha);
+	float sb = sinf(hb), cb = cosf(hb);
+	float sc = sinf(hc), cc = cosf(hc);
+	// a*b
+	float w  = ca * cb;
+	float xa = sa * cb;
+	float xb = ca * sb;
+	float xc = S * sa * sb;
+	// (a*b)*c
+	float q[4];
+	q[A] = xa * cc + S * xb * sc;
+	q[B] = xb * cc - S * xa * sc;
+	q[C] = xc * cc + w * sc;
+	q[3] = w * cc - xc * sc;
+	return Quaternion(q[0], q[1], q[2], q[3]);
+}
+
+void BVH::createChannelMap(unsigned channels, ChannelMap& map) {
+	static const EulerFunc orders[3][3][3] = {
+		{ { 0, 0, 0 }, { 0, 0, eulerToQuaternion<0,1,2, 1> }, { 0, eulerToQuaternion<0,2,1,-1>, 0 } },
+		{ { 0, 0, eulerToQuaternion<1,0,2,-1> }, { 0, 0, 0 }, { eulerToQuaternion<1,2,0, 1>, 0, 0 } },
+		{ { 0, eulerToQuaternion<2,0,1, 1>, 0 }, { eulerToQuaternion<2,1,0,-1>, 0, 0 }, { 0, 0, 0 } },
+	};
+	int axis[3];
+	int rotations = 0;
+	map.count = 0;
+	map.euler = 0;
+	map.position[0] = map.position[1] = map.position[2] = -1;
+	for(unsigned c=channels; c; c>>=3, ++map.count) {
+		int type = c & 0x7;
+		if(type >= Xpos && type <= Zpos) map.position[type-Xpos] = map.count;
+		else if(type >= Xrot && type <= Zrot) {
+			if(rotations < 3) {
+				axis[rotations] = type - Xrot;
+				map.rotation[rotations] = map.count;
+			}
+			++rotations;
+		}
+	}
+	if(rotations == 3) map.euler = orders[ axis[0] ][ axis[1] ][ axis[2] ];
+}
+
+// -------------------------------------------------------------------------- //
+
+BVH::Part* BVH::readHeirachy(const char*& data, int parent, std::vector<int>& parents, std::vector<unsigned>& channels) {
 	whitespace(data);
 
 	// parse name
@@ -68,15 +145,21 @@ BVH::Part* BVH::readHeirachy(const char*& data) {
 
 	// Create part
 	Part* part = new Part;
-	part->parent = -1;
 	part->name = 0;
-	part->channels = 0;
 	part->motion = 0;
-
+	part->packed = 0;
+	part->hasPosition = false;
+	part->keyCount = 0;
+	part->keyFrames = 0;
+	part->constant = false;
+	part->anchor = -1;
+
+	// Names are shared once the whole hierarchy is read, see internSkeleton()
 	if(len>0) {
-		part->name = new char[len+1];
-		memcpy(part->name, name, len);
-		part->name[len] = 0;
+		char* copy = new char[len+1];
+		memcpy(copy, name, len);
+		copy[len] = 0;
+		part->name = copy;
 	}
 
 	// Add part to flat list
@@ -89,6 +172,8 @@ BVH::Part* BVH::readHeirachy(const char*& data) {
 	int index = m_partCount;
 	m_parts[ m_partCount ] = part;
 	++m_partCount;
+	parents.push_back(parent);
+	channels.push_back(0);
 	int channelCount = 0;
 	int childCount = 0;
 
@@ -106,23 +191,26 @@ BVH::Part* BVH::readHeirachy(const char*& data) {
 		// Read active channels
 		else if(word(data, "CHANNELS", 8)) {
 			readInt(data, channelCount);
+			if(channelCount < 0 || channelCount > MAX_CHANNELS) {
+				printf("Error: %d channels\n", channelCount);
+				break;
+			}
 			for(int i=0; i<channelCount; ++i) {
 				whitespace(data);
-				if(     word(data, "Xposition", 9)) part->channels |= Xpos << (i*3);
-				else if(word(data, "Yposition", 9)) part->channels |= Ypos << (i*3);
-				else if(word(data, "Zposition", 9)) part->channels |= Zpos << (i*3);
-				else if(word(data, "Xrotation", 9)) part->channels |= Xrot << (i*3);
-				else if(word(data, "Yrotation", 9)) part->channels |= Yrot << (i*3);
-				else if(word(data, "Zrotation", 9)) part->channels |= Zrot << (i*3);
+				if(     word(data, "Xposition", 9)) channels[index] |= (unsigned)Xpos << (i*3);
+				else if(word(data, "Yposition", 9)) channels[index] |= (unsigned)Ypos << (i*3);
+				else if(word(data, "Zposition", 9)) channels[index] |= (unsigned)Zpos << (i*3);
+				else if(word(data, "Xrotation", 9)) channels[index] |= (unsigned)Xrot << (i*3);
+				else if(word(data, "Yrotation", 9)) channels[index] |= (unsigned)Yrot << (i*3);
+				else if(word(data, "Zrotation", 9)) channels[index] |= (unsigned)Zrot << (i*3);
 				else { printf("Error: invalid channel %.10s\n", data); break; }
 			}
 		}
 
 		// Read child part
 		else if(word(data, "JOINT", 5)) {
-			Part* child = readHeirachy(data);
+			Part* child = readHeirachy(data, index, parents, channels);
 			if(!child) break;
-			child->parent = index;
 			part->end = part->end + child->offset;
 			++childCount;
 		}
@@ -154,12 +242,25 @@ BVH::Part* BVH::readHeirachy(const char*& data) {
 			nextLine(data);
 		}
 	}
-	delete [] part->name;
-	delete part;
+	// The part stays in m_parts, so the destructor frees it
 	return 0;
 }
 
-bool BVH::load(const char* data) {
+void BVH::internSkeleton(const std::vector<int>& parents, const std::vector<unsigned>& channels) {
+	const char** names = new const char*[m_partCount];
+	for(int i=0; i<m_partCount; ++i) names[i] = m_parts[i]->name;
+	m_skeleton = Skeleton::intern(m_partCount, names, &parents[0], &channels[0]);
+	for(int i=0; i<m_partCount; ++i) {
+		delete [] m_parts[i]->name;
+		m_parts[i]->name = m_skeleton->getName(i);
+	}
+	delete [] names;
+}
+
+bool BVH::load(const char* data, int flags) {
+	if(flags & (LAZY|STREAM) && !(flags & HEADER)) m_source = data;
+	m_streaming.store(flags & STREAM, std::memory_order_relaxed);
+
 	while(*data) {
 		whitespace(data);
 
@@ -167,8 +268,12 @@ bool BVH::load(const char* data) {
 		if(word(data, "HIERARCHY", 9)) {
 			nextLine(data);
 			if(word(data, "ROOT", 4)) {
-				m_root = readHeirachy(data);
+				// Parents and channels are only kept here until the skeleton is shared
+				std::vector<int> parents;
+				std::vector<unsigned> channels;
+				m_root = readHeirachy(data, -1, parents, channels);
 				if(!m_root) return false;
+				internSkeleton(parents, channels);
 			}
 		}
 
@@ -184,67 +289,586 @@ bool BVH::load(const char* data) {
 				readFloat(data, m_frameTime);
 				whitespace(data);
 			}
+			if(flags & HEADER) return m_root && m_frames;
 
-			// Initialise memory
+			// Initialise memory. Lazy clips leave it untouched until decoded
+			m_rawMotion = m_source;
 			for(int i=0; i<m_partCount; ++i) {
-				m_parts[i]->motion = new Transform[m_frames];
+				if(m_source) m_parts[i]->motion = (Transform*) ::operator new[](m_frames * sizeof(Transform));
+				else m_parts[i]->motion = new Transform[m_frames];
+				m_parts[i]->keyCount = m_frames;
 			}
 
-			int partIndex;
-			int channel;
-			Part* part;
-			float value;
-			vec3 pos;
-			Quaternion rot;
-			const vec3 xAxis(1,0,0);
-			const vec3 yAxis(0,1,0);
-			const vec3 zAxis(0,0,1);
-			const float toRad = 3.141592653592f / 180;
+			// Work out how to decode each part once, rather than per channel
+			m_channelMaps = new ChannelMap[m_partCount];
+			for(int i=0; i<m_partCount; ++i) {
+				createChannelMap(m_skeleton->getChannels(i), m_channelMaps[i]);
+			}
+
+			// Lazy mode only finds where each frame starts
+			if(m_source) {
+				indexFrames(data);
+				break;
+			}
 
 			// Read frames
+			Transform* pose = new Transform[m_partCount];
 			for(int frame=0; frame<m_frames; ++frame) {
-				partIndex = 0;
-				part = m_parts[0];
-				channel = part->channels;
-				
-				while(*data) {
-					readFloat(data, value);
-					switch(channel&0x7) {
-					case Xpos: pos.x = value; break;
-					case Ypos: pos.y = value; break;
-					case Zpos: pos.z = value; break;
-					case Xrot: rot = rot * Quaternion(xAxis, value*toRad); break;
-					case Yrot: rot = rot * Quaternion(yAxis, value*toRad); break;
-					case Zrot: rot = rot * Quaternion(zAxis, value*toRad); break;
-					}
-					channel >>= 3;
-
-					// Read all values for this part - process!
-					if(channel == 0) {
-						part->motion[frame].rotation = rot;
-						part->motion[frame].offset = pos;
-
-						// Extract matrix for comparison
-						float mat[16];
-						Transform tmp = part->motion[frame];
-						tmp.toMatrix(mat);
-
-						// Next part
-						++partIndex;
-						rot = Quaternion();
-						if(partIndex == m_partCount) break;
-						part = m_parts[partIndex];
-						channel = part->channels;
-					}
+				if(!*data) {
+					printf("Error: expected %d frames, got %d\n", m_frames, frame);
+					setFrameCount(frame);
+					break;
 				}
-
-				nextLine(data);
+				decodeFrame(data, pose);
+				storeFrame(frame, pose);
 			}
+			delete [] pose;
 		}
 		else {
 			return false;
 		}
 	}
-	return m_root && m_frames;
+	if(!m_root || !m_frames) return false;
+
+	int blocks = (m_frames + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	m_blockBounds = new Bounds[blocks];
+	m_bounds.min = vec3(1e30f);
+	m_bounds.max = vec3(-1e30f);
+
+	// Decode the first block now so the clip can be shown straight away.
+	// Processing that needs every frame is skipped
+	if(m_source) {
+		m_blockState = new std::atomic<unsigned char>[blocks];
+		for(int i=0; i<blocks; ++i) m_blockState[i].store(BLOCK_EMPTY, std::memory_order_relaxed);
+		decodeFrames(0, 1);
+		return true;
+	}
+
+	for(int i=0; i<blocks; ++i) {
+		computeBlockBounds(i);
+		expand(m_bounds, m_blockBounds[i].min);
+		expand(m_bounds, m_blockBounds[i].max);
+	}
+	computeClipSphere();
+	m_decodedFrames.store(m_frames, std::memory_order_release);
+	findConstantParts();
+	if(flags & REDUCE) reduce(0.1f, 0.05f);
+	if(flags & COMPRESS) compress();
+	return true;
+}
+
+void BVH::decodeFrame(const char*& data, Transform* pose) const {
+	const float toRad = 3.141592653592f / 180;
+	float values[MAX_CHANNELS];
+	for(int i=0; i<m_partCount; ++i) {
+		const ChannelMap& map = m_channelMaps[i];
+		for(int k=0; k<map.count; ++k) {
+			if(!readFloat(data, values[k])) values[k] = 0;
+		}
+
+		Transform& out = pose[i];
+		out.offset.x = map.position[0]<0? 0: values[ (int)map.position[0] ];
+		out.offset.y = map.position[1]<0? 0: values[ (int)map.position[1] ];
+		out.offset.z = map.position[2]<0? 0: values[ (int)map.position[2] ];
+
+		if(map.euler) {
+			const float s = toRad * 0.5f;
+			out.rotation = map.euler( values[ (int)map.rotation[0] ] * s,
+			                          values[ (int)map.rotation[1] ] * s,
+			                          values[ (int)map.rotation[2] ] * s );
+		}
+		else {
+			// Unusual channel set - apply each rotation in turn
+			const vec3 axis[3] = { vec3(1,0,0), vec3(0,1,0), vec3(0,0,1) };
+			out.rotation = Quaternion();
+			unsigned channel = m_skeleton->getChannels(i);
+			for(int k=0; k<map.count; ++k, channel>>=3) {
+				int type = channel & 0x7;
+				if(type >= Xrot) out.rotation = out.rotation * Quaternion(axis[type-Xrot], values[k] * toRad);
+			}
+		}
+	}
+	nextLine(data);
+}
+
+void BVH::storeFrame(int frame, const Transform* pose) {
+	for(int i=0; i<m_partCount; ++i) new(m_parts[i]->motion + frame) Transform(pose[i]);
+}
+
+void BVH::setFrameCount(int frames) {
+	m_frames = frames;
+	for(int i=0; i<m_partCount; ++i) m_parts[i]->keyCount = frames;
+}
+
+// -------------------------------------------------------------------------- //
+// Lazy decoding
+//
+// The motion text is kept, with the offset of each frame line found by a newline
+// scan. Frames are then decoded a block at a time when first needed.
+
+void BVH::indexFrames(const char* data) {
+	m_frameIndex = new unsigned[m_frames];
+	for(int frame=0; frame<m_frames; ++frame) {
+		if(!*data || (size_t)(data - m_source) > 0xffffffffu) {
+			printf("Error: expected %d frames, got %d\n", m_frames, frame);
+			setFrameCount(frame);
+			break;
+		}
+		m_frameIndex[frame] = data - m_source;
+		data = strchr(data, '\n');
+		if(!data) data = "";
+		whitespace(data);
+	}
+}
+
+void BVH::decodeFrames(int first, int count) {
+	if(!m_blockState) return;
+	if(first < 0) first = 0;
+	int last = first + count - 1;
+	if(last >= m_frames) last = m_frames - 1;
+	Transform* pose = 0;
+	for(int block = first / BLOCK_SIZE; block <= last / BLOCK_SIZE; ++block) {
+		// Claim the block. Skip it if another thread already has
+		unsigned char state = BLOCK_EMPTY;
+		if(!m_blockState[block].compare_exchange_strong(state, BLOCK_DECODING, std::memory_order_acquire)) continue;
+
+		int start = block * BLOCK_SIZE;
+		int end = start + BLOCK_SIZE < m_frames? start + BLOCK_SIZE: m_frames;
+		const char* data = m_source + m_frameIndex[start];
+		if(!pose) pose = new Transform[m_partCount];
+		for(int frame=start; frame<end; ++frame) {
+			decodeFrame(data, pose);
+			storeFrame(frame, pose);
+		}
+		computeBlockBounds(block);
+		m_blockState[block].store(BLOCK_READY, std::memory_order_release);
+
+		base::MutexLock lock(m_boundsLock);
+		expand(m_bounds, m_blockBounds[block].min);
+		expand(m_bounds, m_blockBounds[block].max);
+		computeClipSphere();
+	}
+	delete [] pose;
+
+	// Advance the decoded prefix
+	int decoded = m_decodedFrames.load(std::memory_order_acquire);
+	int prefix = decoded;
+	while(prefix < m_frames && isDecoded(prefix)) prefix = (prefix / BLOCK_SIZE + 1) * BLOCK_SIZE;
+	if(prefix > m_frames) prefix = m_frames;
+	while(prefix > decoded && !m_decodedFrames.compare_exchange_weak(decoded, prefix, std::memory_order_release));
+	if(prefix == m_frames) releaseSource();
+}
+
+/** Free the text once every block is decoded. Nothing decodes from it after that, and
+ * the lock waits for any readFrames() already parsing it */
+void BVH::releaseSource() {
+	base::MutexLock lock(m_sourceLock);
+	if(!m_source) return;
+	free((void*)m_source);
+	delete [] m_frameIndex;
+	m_source = 0;
+	m_frameIndex = 0;
+	m_streaming.store(false, std::memory_order_relaxed);
+}
+
+void BVH::readFrames(int first, int count, Transform* out) const {
+	for(int frame=first; frame<first+count; ++frame, out+=m_partCount) {
+		int f = frame < 0? 0: frame < m_frames? frame: m_frames - 1;
+		if(!isDecoded(f)) {
+			// Straight from the text, leaving the block alone. The text is only freed
+			// once the block is decoded, so it is there if the block is still not ready
+			base::MutexLock lock(m_sourceLock);
+			if(!isDecoded(f)) {
+				const char* data = m_source + m_frameIndex[f];
+				decodeFrame(data, out);
+				continue;
+			}
+		}
+		for(int i=0; i<m_partCount; ++i) getFrame(i, f, out[i]);
+	}
+}
+
+void BVH::getWorldPose(const Transform* local, Transform* world) const {
+	for(int i=0; i<m_partCount; ++i) {
+		const Part* part = m_parts[i];
+		int up = m_skeleton->getParent(i);
+		if(up >= 0) {
+			const Transform& parent = world[up];
+			world[i].offset   = parent.offset + parent.rotation * part->offset;
+			world[i].rotation = parent.rotation * local[i].rotation;
+		}
+		else world[i] = local[i];
+	}
+}
+
+bool BVH::isDecoded(int frame) const {
+	if(!m_blockState || m_frames < 1) return true;
+	if(frame < 0) frame = 0;
+	if(frame >= m_frames) frame = m_frames - 1;
+	return m_blockState[ frame / BLOCK_SIZE ].load(std::memory_order_acquire) == BLOCK_READY;
+}
+
+// -------------------------------------------------------------------------- //
+
+void BVH::computeBlockBounds(int block) {
+	// Joint and bone end positions of the block
+	int first = block * BLOCK_SIZE;
+	int count = first + BLOCK_SIZE > m_frames? m_frames - first: BLOCK_SIZE;
+	vec3* positions = new vec3[count * m_partCount * 2];
+	Transform* pose = new Transform[m_partCount];
+	vec3* p = positions;
+	for(int frame=first; frame<first+count; ++frame) {
+		// Same forward kinematics as View::updateBones
+		for(int i=0; i<m_partCount; ++i) {
+			const Part* part = m_parts[i];
+			int up = m_skeleton->getParent(i);
+			if(up >= 0) {
+				const Transform& parent = pose[up];
+				pose[i].offset   = parent.offset + parent.rotation * part->offset;
+				pose[i].rotation = parent.rotation * part->motion[frame].rotation;
+			}
+			else pose[i] = part->motion[frame];
+			*p++ = pose[i].offset;
+			*p++ = pose[i].offset + pose[i].rotation * part->end;
+		}
+	}
+
+	Bounds& b = m_blockBounds[block];
+	b.min = vec3(1e30f);
+	b.max = vec3(-1e30f);
+	int n = p - positions;
+	for(int i=0; i<n; ++i) expand(b, positions[i]);
+	b.centre = (b.min + b.max) * 0.5f;
+	b.radius = 0;
+	for(int i=0; i<n; ++i) {
+		float d = (positions[i] - b.centre).length();
+		if(d > b.radius) b.radius = d;
+	}
+	delete [] positions;
+	delete [] pose;
+}
+
+void BVH::computeClipSphere() {
+	// Whole clip sphere encloses the block spheres
+	m_bounds.centre = (m_bounds.min + m_bounds.max) * 0.5f;
+	m_bounds.radius = 0;
+	int blocks = (m_frames + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	for(int i=0; i<blocks; ++i) {
+		if(!isDecoded(i * BLOCK_SIZE)) continue;
+		const Bounds& b = m_blockBounds[i];
+		float d = (b.centre - m_bounds.centre).length() + b.radius;
+		if(d > m_bounds.radius) m_bounds.radius = d;
+	}
+}
+
+// -------------------------------------------------------------------------- //
+// Compressed motion
+//
+// Rotations use smallest-three quantisation in 48 bits: 2 bits select the largest
+// component, which is dropped and rebuilt from the unit length. The other three lie
+// in [-1/sqrt2, 1/sqrt2] and get 15 bits each. Worst case angle error is ~0.005
+// degrees. Positions are only kept for parts with position channels, as 16 bits per
+// axis over the range of that track - error is range/131070, or 0.04mm over 5m.
+// A frame of a 59 joint rig drops from 1652 bytes to 360 (4.6x).
+
+static const float packRange = 0.70710678f;	// 1/sqrt(2)
+static const int   packBits = 32767;
+
+inline unsigned quantise(float v, float min, float scale, unsigned max) {
+	float q = (v - min) * scale + 0.5f;
+	if(q < 0) return 0;
+	if(q > max) return max;
+	return (unsigned) q;
+}
+
+void BVH::compress() {
+	size_t before = 0, after = 0;
+	for(int i=0; i<m_partCount; ++i) {
+		Part* part = m_parts[i];
+		part->hasPosition = false;
+		for(unsigned c=m_skeleton->getChannels(i); c; c>>=3) {
+			if((c&7) >= Xpos && (c&7) <= Zpos) part->hasPosition = true;
+		}
+
+		// Position range
+		vec3 min(1e30f), max(-1e30f);
+		if(part->hasPosition) {
+			for(int f=0; f<part->keyCount; ++f) {
+				const vec3& p = part->motion[f].offset;
+				if(p.x < min.x) min.x = p.x;
+				if(p.y < min.y) min.y = p.y;
+				if(p.z < min.z) min.z = p.z;
+				if(p.x > max.x) max.x = p.x;
+				if(p.y > max.y) max.y = p.y;
+				if(p.z > max.z) max.z = p.z;
+			}
+			part->packMin = min;
+			part->packScale.x = max.x > min.x? (max.x - min.x) / 65535: 0;
+			part->packScale.y = max.y > min.y? (max.y - min.y) / 65535: 0;
+			part->packScale.z = max.z > min.z? (max.z - min.z) / 65535: 0;
+		}
+
+		int stride = part->hasPosition? 6: 3;
+		part->packed = new unsigned short[ part->keyCount * stride ];
+		for(int f=0; f<part->keyCount; ++f) {
+			unsigned short* out = part->packed + f * stride;
+			const Quaternion& q = part->motion[f].rotation;
+			float c[4] = { q.x, q.y, q.z, q.w };
+			float l = 1.f / sqrt(c[0]*c[0] + c[1]*c[1] + c[2]*c[2] + c[3]*c[3]);
+			int largest = 0;
+			for(int k=1; k<4; ++k) if(fabs(c[k]) > fabs(c[largest])) largest = k;
+			if(c[largest] < 0) l = -l;
+
+			unsigned long long bits = largest;
+			const float scale = packBits / (2 * packRange);
+			for(int k=0; k<4; ++k) {
+				if(k == largest) continue;
+				bits = bits << 15 | quantise(c[k] * l, -packRange, scale, packBits);
+			}
+			out[0] = bits >> 32;
+			out[1] = bits >> 16;
+			out[2] = bits;
+
+			if(part->hasPosition) {
+				const vec3& p = part->motion[f].offset;
+				const vec3& s = part->packScale;
+				out[3] = s.x > 0? quantise(p.x, min.x, 1 / s.x, 65535): 0;
+				out[4] = s.y > 0? quantise(p.y, min.y, 1 / s.y, 65535): 0;
+				out[5] = s.z > 0? quantise(p.z, min.z, 1 / s.z, 65535): 0;
+			}
+		}
+
+		delete [] part->motion;
+		part->motion = 0;
+		before += part->keyCount * sizeof(Transform);
+		after += part->keyCount * stride * sizeof(unsigned short);
+	}
+	m_compressed = true;
+	printf("Compressed motion %.1fKB -> %.1fKB\n", before / 1024.f, after / 1024.f);
+}
+
+void BVH::unpack(const Part* part, int frame, Transform& out) {
+	int stride = part->hasPosition? 6: 3;
+	const unsigned short* in = part->packed + frame * stride;
+	unsigned long long bits = (unsigned long long)in[0] << 32 | (unsigned)in[1] << 16 | in[2];
+	int largest = bits >> 45;
+	const float scale = 2 * packRange / packBits;
+	float c[4];
+	float sum = 0;
+	for(int k=3; k>=0; --k) {
+		if(k == largest) continue;
+		c[k] = (bits & 0x7fff) * scale - packRange;
+		sum += c[k] * c[k];
+		bits >>= 15;
+	}
+	c[largest] = sum < 1? sqrt(1 - sum): 0;
+	out.rotation = Quaternion(c[0], c[1], c[2], c[3]);
+
+	if(part->hasPosition) {
+		out.offset.x = part->packMin.x + in[3] * part->packScale.x;
+		out.offset.y = part->packMin.y + in[4] * part->packScale.y;
+		out.offset.z = part->packMin.z + in[5] * part->packScale.z;
+	}
+	else out.offset = vec3();
+}
+
+// -------------------------------------------------------------------------- //
+// Constant parts
+//
+// Fingers and toes are often exported with channels that never change. These are
+// stored as a single key, and their transform relative to the nearest moving
+// ancestor is precomputed so FK can skip interpolating each joint in the chain.
+
+inline bool equal(const Transform& a, const Transform& b) {
+	const float e = 1e-6f;
+	return fabs(a.rotation.x - b.rotation.x) < e && fabs(a.rotation.y - b.rotation.y) < e
+	    && fabs(a.rotation.z - b.rotation.z) < e && fabs(a.rotation.w - b.rotation.w) < e
+	    && fabs(a.offset.x - b.offset.x) < e && fabs(a.offset.y - b.offset.y) < e
+	    && fabs(a.offset.z - b.offset.z) < e;
+}
+
+void BVH::findConstantParts() {
+	int count = 0;
+	for(int i=0; i<m_partCount; ++i) {
+		Part* part = m_parts[i];
+		const Transform* motion = part->motion;
+		int f = 1;
+		while(f < m_frames && equal(motion[f], motion[0])) ++f;
+		if(f < m_frames) continue;
+
+		// Store once
+		Transform* key = new Transform[1];
+		key[0] = motion[0];
+		delete [] part->motion;
+		part->motion = key;
+		part->keyCount = 1;
+		part->constant = true;
+		++count;
+
+		// Parts are ordered parent first, so the parent chain is already resolved
+		Transform local = key[0];
+		int p = m_skeleton->getParent(i);
+		if(p >= 0) local.offset = part->offset;
+		const Part* parent = p>=0? m_parts[p]: 0;
+		if(parent && parent->constant) {
+			part->anchor = parent->anchor;
+			part->relative.offset   = parent->relative.offset + parent->relative.rotation * local.offset;
+			part->relative.rotation = parent->relative.rotation * local.rotation;
+		}
+		else {
+			part->anchor = p;
+			part->relative = local;
+		}
+	}
+	if(count) printf("%d of %d parts are constant\n", count, m_partCount);
+}
+
+// -------------------------------------------------------------------------- //
+// Keyframe reduction
+//
+// Each track is split into the longest segments whose inner frames are within
+// the error bounds of slerp/lerp between the segment end points. Segment length
+// grows exponentially then binary searches back, so fitting is O(n log n).
+
+/** Angle in degrees between two rotations. Uses atan2 of the difference rotation,
+ * as acos of the dot product has no precision left at these small angles */
+inline float angleBetween(const Quaternion& a, const Quaternion& b) {
+	double w = (double)a.w*b.w + (double)a.x*b.x + (double)a.y*b.y + (double)a.z*b.z;
+	double x = (double)a.w*b.x - (double)a.x*b.w - (double)a.y*b.z + (double)a.z*b.y;
+	double y = (double)a.w*b.y - (double)a.y*b.w - (double)a.z*b.x + (double)a.x*b.z;
+	double z = (double)a.w*b.z - (double)a.z*b.w - (double)a.x*b.y + (double)a.y*b.x;
+	return atan2(sqrt(x*x + y*y + z*z), fabs(w)) * 2 * 180 / 3.141592653592;
+}
+
+/** Test whether all frames between a and b are close to interpolated values */
+static bool fitSegment(const Transform* motion, int a, int b, float angle, float distance, float& maxAngle, float& maxDistance) {
+	float segAngle = 0, segDistance = 0;
+	for(int i=a+1; i<b; ++i) {
+		float t = (float)(i - a) / (b - a);
+		float e = angleBetween(motion[i].rotation, slerp(motion[a].rotation, motion[b].rotation, t));
+		float d = (motion[i].offset - lerp(motion[a].offset, motion[b].offset, t)).length();
+		if(e > angle || d > distance) return false;
+		if(e > segAngle) segAngle = e;
+		if(d > segDistance) segDistance = d;
+	}
+	maxAngle = segAngle;
+	maxDistance = segDistance;
+	return true;
+}
+
+void BVH::reduce(float angle, float distance) {
+	const int maxSegment = 1024;
+	int before = 0, after = 0;
+	float errorAngle = 0, errorDistance = 0;
+	int* keys = new int[m_frames];
+	for(int p=0; p<m_partCount; ++p) {
+		Part* part = m_parts[p];
+		const Transform* motion = part->motion;
+		before += m_frames;
+		if(part->constant) {
+			++after;
+			continue;
+		}
+		int count = 0;
+		int a = 0;
+		keys[count++] = 0;
+		while(a < m_frames - 1) {
+			float e, d, segAngle = 0, segDistance = 0;
+			int last = m_frames - 1 - a;
+			if(last > maxSegment) last = maxSegment;
+
+			// Grow segment
+			int good = 1, bad = last + 1;
+			for(int len=2; len<=last; len*=2) {
+				if(fitSegment(motion, a, a+len, angle, distance, e, d)) { good = len; segAngle = e; segDistance = d; }
+				else { bad = len; break; }
+			}
+			if(bad > last && good < last) {
+				if(fitSegment(motion, a, a+last, angle, distance, e, d)) { good = last; segAngle = e; segDistance = d; }
+				else bad = last;
+			}
+			// Refine
+			while(bad - good > 1) {
+				int mid = (good + bad) / 2;
+				if(fitSegment(motion, a, a+mid, angle, distance, e, d)) { good = mid; segAngle = e; segDistance = d; }
+				else bad = mid;
+			}
+
+			if(segAngle > errorAngle) errorAngle = segAngle;
+			if(segDistance > errorDistance) errorDistance = segDistance;
+			a += good;
+			keys[count++] = a;
+		}
+
+		after += count;
+		part->keyCount = count;
+		if(count < m_frames) {
+			Transform* reduced = new Transform[count];
+			part->keyFrames = new int[count];
+			for(int k=0; k<count; ++k) {
+				reduced[k] = motion[ keys[k] ];
+				part->keyFrames[k] = keys[k];
+			}
+			delete [] part->motion;
+			part->motion = reduced;
+		}
+	}
+	delete [] keys;
+	printf("Reduced %d keys to %d (%.1fx), max error %.3f degrees, %.3f units\n",
+		before, after, (float)before / after, errorAngle, errorDistance);
+}
+
+float BVH::findKey(int index, float frame, int& cursor) const {
+	const Part* part = m_parts[index];
+	int last = part->keyCount - 1;
+	if(frame <= 0) { cursor = 0; return 0; }
+	if(!part->keyFrames) {
+		cursor = (int) frame;
+		if(cursor >= last) { cursor = last; return 0; }
+		return frame - cursor;
+	}
+
+	const int* keys = part->keyFrames;
+	if(cursor < 0 || cursor > last || keys[cursor] > frame) cursor = 0;
+	// Step forward from the last segment, fall back to a search for big jumps
+	int steps = 0;
+	while(cursor < last && keys[cursor+1] <= frame && ++steps < 4) ++cursor;
+	if(cursor < last && keys[cursor+1] <= frame) {
+		int lo = cursor, hi = last;
+		while(hi - lo > 1) {
+			int mid = (lo + hi) / 2;
+			if(keys[mid] <= frame) lo = mid;
+			else hi = mid;
+		}
+		cursor = keys[hi] <= frame? hi: lo;
+	}
+	if(cursor >= last) { cursor = last; return 0; }
+	return (frame - keys[cursor]) / (keys[cursor+1] - keys[cursor]);
+}
+
+void BVH::getFrame(int index, int frame, Transform& out) const {
+	int key = 0;
+	float t = findKey(index, frame, key);
+	getKey(index, key, out);
+	if(t > 0) {
+		Transform next;
+		getKey(index, key+1, next);
+		out.offset = lerp(out.offset, next.offset, t);
+		out.rotation = slerp(out.rotation, next.rotation, t);
+	}
+}
+
+// -------------------------------------------------------------------------- //
+
+BVH::Bounds BVH::getBounds() const {
+	base::MutexLock lock(m_boundsLock);
+	return m_bounds;
+}
+
+BVH::Bounds BVH::getBounds(int frame) const {
+	if(frame < 0) frame = 0;
+	if(frame >= m_frames) frame = m_frames - 1;
+	if(!isDecoded(frame)) return getBounds();
+	return m_blockBounds[ frame / BLOCK_SIZE ];
 }
 
@@ -2,6 +2,10 @@
 #define _BVH_
 
 #include "transform.h"
+#include "thread.h"
+#include "skeleton.h"
+#include <atomic>
+#include <vector>
 
 /** bvh mocap data */
 class BVH {
@@ -9,36 +13,150 @@ class BVH {
 
 	enum Channel { Xpos=1, Ypos, Zpos, Xrot, Yrot, Zrot };
 
+	/** Load options */
+	enum LoadFlags {
+		COMPRESS = 1,	// Keep motion quantised in memory - see compress()
+		REDUCE   = 2,	// Fit error bounded keyframes to each track - see reduce()
+		LAZY     = 4,	// Decode frames when first needed. Ignores REDUCE and COMPRESS
+		STREAM   = 8,	// As LAZY, but the loader decodes the rest with decodeFrames() and
+		                // playback is limited to getPlayableFrames()
+		HEADER   = 16,	// Only read the hierarchy, frame count and frame time
+	};
+
+	/** Per clip data of a joint. Its parent and channels are read from the shared Skeleton */
 	struct Part {
-		int        parent;
 		vec3       offset;
 		vec3       end;
-		char*      name;
-		Transform* motion;
-		int        channels;
+		const char* name;			// Owned by the skeleton
+		Transform* motion;			// Decoded keys, null if compressed
+
+		int        keyCount;		// Number of keys in motion or packed
+		int*       keyFrames;		// Frame of each key, null if every frame is a key
+
+		unsigned short* packed;		// Compressed keys: 3 rotation words, then 3 position words if hasPosition
+		bool            hasPosition;	// Part has position channels
+		vec3            packMin;		// Range of quantised positions
+		vec3            packScale;
+
+		bool       constant;		// Local transform never changes. Stored as a single key
+		int        anchor;			// Nearest ancestor that moves, or -1. Only set if constant
+		Transform  relative;		// Transform relative to anchor. Only set if constant
 	};
 
+	/** Axis aligned box and enclosing sphere of all joints and bone ends */
+	struct Bounds {
+		vec3  min, max;
+		vec3  centre;
+		float radius;
+	};
+
+	/** Frames per block of precomputed bounds */
+	static const int BLOCK_SIZE = 64;
+	/** Most channels a joint may have. Each takes 3 bits of Skeleton::getChannels() */
+	static const int MAX_CHANNELS = 10;
+	/** Decode state of a block of LAZY frames */
+	enum BlockState { BLOCK_EMPTY, BLOCK_DECODING, BLOCK_READY };
+
 	public:
 	BVH();
 	~BVH();
 
-	bool load(const char* data);
+	/** Load bvh data from text. With LAZY, the BVH keeps data and frees it once every
+	 * frame is decoded, so it must have been allocated with malloc */
+	bool load(const char* data, int flags=0);
+
+	/** Decode the blocks of frames [first, first+count) that nobody has started. Blocks another
+	 * thread is decoding are skipped rather than waited for, so check isDecoded() afterwards.
+	 * Only does work for LAZY clips */
+	void decodeFrames(int first, int count=1);
+	/** Has a frame been decoded yet. Safe to call while another thread decodes */
+	bool isDecoded(int frame) const;
+	/** Number of frames from the start that are decoded */
+	int  getDecodedFrames() const           { return m_decodedFrames.load(std::memory_order_acquire); }
+	/** Number of frames playback may use. Less than getFrames() while a STREAM clip loads */
+	int  getPlayableFrames() const          { return isStreaming()? getDecodedFrames(): m_frames; }
+	/** True while a STREAM clip still has frames to decode */
+	bool isStreaming() const                { return m_streaming.load(std::memory_order_relaxed); }
+
+	/** Seek: get the local transforms of all parts for frames [first, first+count).
+	 * Frames of LAZY clips that are not decoded yet are parsed straight from the text
+	 * using the frame index, without decoding the rest of their block.
+	 * @param out partCount transforms per frame */
+	void readFrames(int first, int count, Transform* out) const;
+	/** Combine one frame of local transforms into world transforms. The offset of
+	 * each world transform is the joint position */
+	void getWorldPose(const Transform* local, Transform* world) const;
 
 	int         getPartCount() const		{ return m_partCount; }
+	/** Shared joint names, parents and channels */
+	const Skeleton* getSkeleton() const     { return m_skeleton; }
 	const Part* getPart(int index) const    { return m_parts[index]; }
+	/** Parent of a part, or -1 for the root */
+	int         getParent(int index) const  { return m_skeleton->getParent(index); }
 	int         getFrames() const           { return m_frames; }
 	float       getFrameTime() const        { return m_frameTime; }
+	bool        isCompressed() const        { return m_compressed; }
+
+	/** Get a key of a part, decoding it if needed */
+	void getKey(int part, int key, Transform& out) const {
+		const Part* p = m_parts[part];
+		if(p->motion) out = p->motion[key];
+		else unpack(p, key, out);
+	}
+
+	/** Find the keys either side of a frame.
+	 * @param cursor Set to the key at or before frame. Pass in the value from the previous
+	 *               call on this part, so that sequential playback does not need a search
+	 * @return Interpolation weight between key cursor and cursor+1 */
+	float findKey(int part, float frame, int& cursor) const;
+
+	/** Get the local transform of a part at a frame, decoding it if needed */
+	void getFrame(int part, int frame, Transform& out) const;
 
+	/** Bounds of the whole clip, or the decoded part of it */
+	Bounds getBounds() const;
+	/** Bounds of the block of frames containing frame */
+	Bounds getBounds(int frame) const;
 
 	private:
-	Part* readHeirachy(const char*& data);
+	struct ChannelMap;
+	typedef Quaternion (*EulerFunc)(float, float, float);
+	Part* readHeirachy(const char*& data, int parent, std::vector<int>& parents, std::vector<unsigned>& channels);
+	void  internSkeleton(const std::vector<int>& parents, const std::vector<unsigned>& channels);
+	static void createChannelMap(unsigned channels, ChannelMap& map);
+	void decodeFrame(const char*& data, Transform* pose) const;
+	void storeFrame(int frame, const Transform* pose);
+	void setFrameCount(int frames);
+	void indexFrames(const char* data);
+	void releaseSource();
+	void computeBlockBounds(int block);
+	void computeClipSphere();
+	void compress();
+	void reduce(float angle, float distance);
+	void findConstantParts();
+	static void unpack(const Part* part, int frame, Transform& out);
 
 	protected:
 	Part*  m_root;
+	const Skeleton* m_skeleton;
 	Part** m_parts;
 	int    m_partCount;
 	int    m_frames;
 	float  m_frameTime;
+	bool   m_compressed;
+
+	Bounds  m_bounds;		// Whole clip
+	Bounds* m_blockBounds;	// Per BLOCK_SIZE frames
+
+	ChannelMap* m_channelMaps;	// How to decode each part's values
+	const char* m_source;		// Text of LAZY clips, until every frame is decoded
+	unsigned*   m_frameIndex;	// Offset of each frame line in m_source
+	bool        m_rawMotion;	// Motion arrays were allocated without constructing keys
+	mutable base::Mutex m_sourceLock;	// Stops the text being freed while readFrames() parses it
+	std::atomic<unsigned char>* m_blockState;	// Decode state of each block of LAZY clips
+	std::atomic<int> m_decodedFrames;			// Frames decoded from the start
+	std::atomic<bool> m_streaming;
+	mutable base::Mutex m_boundsLock;			// Guards m_bounds while blocks decode
 
 
 };
@@ -0,0 +1,199 @@
+#include "catalog.h"
+#include "zip.h"
+#include "bvh.h"
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+
+Catalog::Catalog() : m_lastDirectory(-1) {
+	memset(m_info, 0, sizeof(m_info));
+}
+
+Catalog::~Catalog() {
+	for(size_t i=0; i<m_archives.size(); ++i) delete m_archives[i];
+	for(int i=0; i<INFO_BLOCKS; ++i) delete [] m_info[i];
+}
+
+unsigned Catalog::addString(const char* s, size_t length) {
+	unsigned offset = m_strings.size();
+	m_strings.insert(m_strings.end(), s, s + length);
+	m_strings.push_back(0);
+	return offset;
+}
+
+unsigned Catalog::addDirectory(const char* path, size_t length) {
+	if(length == 0) path = ".", length = 1;
+	if(m_lastDirectory >= 0) {
+		const char* last = &m_strings[ m_directories[m_lastDirectory] ];
+		if(strncmp(last, path, length) == 0 && last[length] == 0) return m_lastDirectory;
+	}
+	std::string key(path, length);
+	std::map<std::string, unsigned>::iterator it = m_directoryLookup.find(key);
+	if(it == m_directoryLookup.end()) {
+		it = m_directoryLookup.insert( std::make_pair(key, (unsigned)m_directories.size()) ).first;
+		m_directories.push_back( addString(path, length) );
+	}
+	m_lastDirectory = it->second;
+	return it->second;
+}
+
+void Catalog::addEntry(const char* path, int archive, int zipIndex) {
+	int index = m_entries.size();
+	if(index >= INFO_BLOCK * INFO_BLOCKS) {
+		printf("Too many files, ignoring %s\n", path);
+		return;
+	}
+	if(!m_info[index / INFO_BLOCK]) {
+		Info* block = new Info[INFO_BLOCK];
+		for(int i=0; i<INFO_BLOCK; ++i) {
+			block[i].frames.store(-1, std::memory_order_relaxed);
+			block[i].joints.store(0, std::memory_order_relaxed);
+			block[i].rig.store(-1, std::memory_order_relaxed);
+			block[i].frameTime.store(0, std::memory_order_relaxed);
+			block[i].features.store(COLUMN_NONE, std::memory_order_relaxed);
+			block[i].fingerprint.store(COLUMN_NONE, std::memory_order_relaxed);
+		}
+		m_info[index / INFO_BLOCK] = block;
+	}
+
+	const char* slash = strrchr(path, '/');
+	if(!slash) slash = strrchr(path, '\\');
+	const char* name = slash? slash + 1: path;
+	Entry e;
+	e.directory = addDirectory(path, slash? slash - path: 0);
+	e.name = addString(name, strlen(name));
+	e.archive = archive;
+	e.zipIndex = zipIndex;
+	m_entries.push_back(e);
+}
+
+void Catalog::addFile(const char* path) {
+	base::MutexLock lock(m_lock);
+	addEntry(path, -1, -1);
+}
+
+void Catalog::addArchive(ZipArchive* zip) {
+	base::MutexLock lock(m_lock);
+	int archive = m_archives.size();
+	m_archives.push_back(zip);
+	m_entries.reserve(m_entries.size() + zip->getEntryCount());
+	for(int i=0; i<zip->getEntryCount(); ++i) addEntry(zip->getName(i), archive, i);
+}
+
+bool Catalog::hasArchive(const char* path) const {
+	for(size_t i=0; i<m_archives.size(); ++i) {
+		if(strcmp(m_archives[i]->path(), path) == 0) return true;
+	}
+	return false;
+}
+
+std::string Catalog::getPath(int i) const {
+	return std::string(getDirectory(i)) + "/" + getName(i);
+}
+
+Catalog::Source Catalog::getSource(int i) const {
+	base::MutexLock lock(m_lock);
+	Source source;
+	source.name = getName(i);
+	source.archive = getArchive(i);
+	source.zipIndex = m_entries[i].zipIndex;
+	if(!source.archive) source.path = getPath(i);
+	return source;
+}
+
+int Catalog::find(const char* name) const {
+	for(size_t i=0; i<m_entries.size(); ++i) {
+		if(strcmp(getName(i), name) == 0) return i;
+	}
+	return -1;
+}
+
+const char* Catalog::getArchivePath(int a) const {
+	return m_archives[a]->path();
+}
+
+// ------------------------------------------------- //
+
+void Catalog::setInfo(int i, int frames, int joints, float frameTime, int rig) {
+	Info& d = info(i);
+	d.joints.store(joints, std::memory_order_relaxed);
+	d.rig.store(rig, std::memory_order_relaxed);
+	d.frameTime.store(frameTime, std::memory_order_relaxed);
+	d.frames.store(frames, std::memory_order_release);
+}
+
+bool Catalog::hasInfo(int i) const {
+	return info(i).frames.load(std::memory_order_acquire) >= 0;
+}
+
+bool Catalog::getInfo(int i, int& frames, int& joints, float& frameTime, int& rig) const {
+	const Info& d = info(i);
+	frames = d.frames.load(std::memory_order_acquire);
+	if(frames < 0) return false;
+	joints = d.joints.load(std::memory_order_relaxed);
+	rig = d.rig.load(std::memory_order_relaxed);
+	frameTime = d.frameTime.load(std::memory_order_relaxed);
+	return true;
+}
+
+bool Catalog::readInfo(int i) {
+	// Headers are a few kilobytes. Large skeletons may need more
+	static const size_t headerSize = 64 << 10;
+	Source source = getSource(i);
+	char* data = 0;
+	if(source.archive) {
+		data = source.archive->extract(source.zipIndex, 0, headerSize);
+	}
+	else {
+		FILE* fp = fopen(source.path.c_str(), "rb");
+		if(!fp) return false;
+		data = (char*)malloc(headerSize + 1);
+		size_t length = fread(data, 1, headerSize, fp);
+		data[length] = 0;
+		fclose(fp);
+	}
+	if(!data) return false;
+	BVH bvh;
+	bool ok = bvh.load(data, BVH::HEADER);
+	if(ok) setInfo(i, bvh.getFrames(), bvh.getPartCount(), bvh.getFrameTime(), bvh.getSkeleton()->getRig());
+	free(data);
+	return ok;
+}
+// ------------------------------------------------- //
+
+bool Catalog::claim(std::atomic<unsigned char>& state) {
+	unsigned char none = COLUMN_NONE;
+	return state.compare_exchange_strong(none, COLUMN_WRITING, std::memory_order_acquire);
+}
+
+void Catalog::setFeatures(int i, const float* features) {
+	if(!claim(info(i).features)) return;
+	memcpy(m_features[i].value, features, sizeof(m_features[i].value));
+	info(i).features.store(COLUMN_READY, std::memory_order_release);
+}
+
+bool Catalog::hasFeatures(int i) const {
+	return info(i).features.load(std::memory_order_acquire) == COLUMN_READY;
+}
+
+bool Catalog::getFeatures(int i, float* features) const {
+	if(!hasFeatures(i)) return false;
+	memcpy(features, m_features[i].value, sizeof(m_features[i].value));
+	return true;
+}
+
+void Catalog::setFingerprint(int i, const Fingerprint& fingerprint) {
+	if(!claim(info(i).fingerprint)) return;
+	m_fingerprints[i] = fingerprint;
+	info(i).fingerprint.store(COLUMN_READY, std::memory_order_release);
+}
+
+bool Catalog::hasFingerprint(int i) const {
+	return info(i).fingerprint.load(std::memory_order_acquire) == COLUMN_READY;
+}
+
+bool Catalog::getFingerprint(int i, Fingerprint& fingerprint) const {
+	if(!hasFingerprint(i)) return false;
+	fingerprint = m_fingerprints[i];
+	return true;
+}
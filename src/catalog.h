@@ -0,0 +1,133 @@
+#ifndef _CATALOG_
+#define _CATALOG_
+
+#include <vector>
+#include <string>
+#include <map>
+#include <atomic>
+#include "thread.h"
+#include "motion.h"
+#include "duplicates.h"
+
+class ZipArchive;
+
+/** Every bvh file found. Directory and archive paths are stored once and file
+ * names share one string pool, so an entry is just a few indices.
+ * Files are added from the main thread, which may read the tables freely.
+ * Other threads use getSource() and the info functions. */
+class Catalog {
+	public:
+	struct Entry {
+		unsigned name;		// Offset of the file name in the string pool
+		unsigned directory;	// Directory table index
+		int      archive;	// Archive table index, or -1 for loose files
+		int      zipIndex;	// Entry index in the archive
+	};
+
+	Catalog();
+	~Catalog();
+
+	/** Add a loose file */
+	void addFile(const char* path);
+	/** Add every entry of an open archive. The catalog takes ownership of it */
+	void addArchive(ZipArchive* zip);
+	bool hasArchive(const char* path) const;
+
+	int size() const                         { return m_entries.size(); }
+	const Entry& operator[](int i) const     { return m_entries[i]; }
+	const char* getName(int i) const         { return &m_strings[ m_entries[i].name ]; }
+	const char* getDirectory(int i) const    { return &m_strings[ m_directories[ m_entries[i].directory ] ]; }
+	ZipArchive* getArchive(int i) const      { return m_entries[i].archive < 0? 0: m_archives[ m_entries[i].archive ]; }
+	/** Path of a loose file */
+	std::string getPath(int i) const;
+
+	/** Where to read a file from, copied so other threads can use it while files are added */
+	struct Source {
+		std::string name;
+		std::string path;		// Loose files
+		ZipArchive* archive;	// Archived files
+		int         zipIndex;
+	};
+	Source getSource(int i) const;
+	/** Index of the first file with this name, or -1 */
+	int find(const char* name) const;
+
+	/** Directory and archive tables */
+	int getDirectoryCount() const            { return m_directories.size(); }
+	const char* getDirectoryPath(int d) const { return &m_strings[ m_directories[d] ]; }
+	int getArchiveCount() const              { return m_archives.size(); }
+	const char* getArchivePath(int a) const;
+
+	/** Clip details, known once a file has been loaded or its header read. Files with
+	 * the same rig have the same joint names, parents and channels.
+	 * Safe to use from any thread */
+	void setInfo(int i, int frames, int joints, float frameTime, int rig);
+	bool getInfo(int i, int& frames, int& joints, float& frameTime, int& rig) const;
+	bool hasInfo(int i) const;
+	/** Read just the header of a file to fill in its info. Safe to use from any thread */
+	bool readInfo(int i);
+
+	/** Motion features, see MotionFeatures. Safe to use from any thread. The first set wins */
+	void setFeatures(int i, const float* features);
+	bool getFeatures(int i, float* features) const;
+	bool hasFeatures(int i) const;
+	/** Duplicate detection hashes, see Fingerprint. Safe to use from any thread. The first set wins */
+	void setFingerprint(int i, const Fingerprint& fingerprint);
+	bool getFingerprint(int i, Fingerprint& fingerprint) const;
+	bool hasFingerprint(int i) const;
+
+	protected:
+	unsigned addString(const char* s, size_t length);
+	unsigned addDirectory(const char* path, size_t length);
+	void     addEntry(const char* path, int archive, int zipIndex);
+
+	/** Info lives in fixed blocks that never move, so it can be written while files are added */
+	struct Info {
+		std::atomic<int>   frames;		// -1 until known
+		std::atomic<int>   joints;
+		std::atomic<float> frameTime;
+		std::atomic<int>   rig;			// Skeleton::getRig()
+		std::atomic<unsigned char> features;	// A ColumnState for each Column
+		std::atomic<unsigned char> fingerprint;
+	};
+	enum ColumnState { COLUMN_NONE, COLUMN_WRITING, COLUMN_READY };
+
+	static const int INFO_BLOCK = 4096;
+	static const int INFO_BLOCKS = 1024;
+	Info& info(int i) const                  { return m_info[i / INFO_BLOCK][i % INFO_BLOCK]; }
+
+	/** Per file data that is only computed for some libraries. Blocks are made on first use
+	 * and never move, so values can be written while files are added */
+	template<class T> struct Column {
+		std::atomic<T*> blocks[INFO_BLOCKS];
+		Column()  { for(int i=0; i<INFO_BLOCKS; ++i) blocks[i].store(0, std::memory_order_relaxed); }
+		~Column() { for(int i=0; i<INFO_BLOCKS; ++i) delete [] blocks[i].load(std::memory_order_relaxed); }
+		T& operator[](int i) {
+			std::atomic<T*>& slot = blocks[i / INFO_BLOCK];
+			T* block = slot.load(std::memory_order_acquire);
+			if(!block) {
+				T* created = new T[INFO_BLOCK];
+				if(slot.compare_exchange_strong(block, created, std::memory_order_acq_rel)) block = created;
+				else delete [] created;
+			}
+			return block[i % INFO_BLOCK];
+		}
+		const T& operator[](int i) const { return blocks[i / INFO_BLOCK].load(std::memory_order_acquire)[i % INFO_BLOCK]; }
+	};
+	/** Take the right to write a column value. Only the first caller gets it */
+	static bool claim(std::atomic<unsigned char>& state);
+
+	std::vector<Entry>       m_entries;
+	std::vector<char>        m_strings;			// Names and paths, null terminated
+	std::vector<unsigned>    m_directories;		// Directory paths in m_strings
+	std::vector<ZipArchive*> m_archives;
+	std::map<std::string, unsigned> m_directoryLookup;
+	int                      m_lastDirectory;	// Files arrive grouped by directory
+	Info*                    m_info[INFO_BLOCKS];
+	Column<MotionFeatures>   m_features;
+	Column<Fingerprint>      m_fingerprints;
+	mutable base::Mutex      m_lock;			// Held while adding, and by getSource()
+};
+
+#endif
+
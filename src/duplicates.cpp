@@ -0,0 +1,181 @@
+#include "duplicates.h"
+#include "catalog.h"
+#include "bvh.h"
+#include <cstdio>
+#include <cmath>
+
+/** splitmix64 finaliser */
+static inline unsigned long long mix(unsigned long long h) {
+	h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ull;
+	h ^= h >> 27; h *= 0x94d049bb133111ebull;
+	return h ^ (h >> 31);
+}
+static inline unsigned long long combine(unsigned long long h, long long v) {
+	return mix(h ^ (unsigned long long)v) + 0x9e3779b97f4a7c15ull;
+}
+static inline long long quantise(float v, float steps) {
+	return (long long)floor(v * steps + 0.5f);
+}
+
+/** Seconds between the poses that make up signature runs, so frame rate does not matter */
+static const float poseInterval = 0.1f;
+/** Pose quantisation. Rotation components in steps of 1/8 still tell most poses apart */
+static const float coarseSteps = 8;
+static const float fineSteps = 4096;
+
+/** Update the MinHash signature with one run of poses */
+static void addRun(Fingerprint& f, unsigned long long run) {
+	for(int k=0; k<Fingerprint::SIGNATURE; ++k) {
+		unsigned v = (unsigned)mix(run + k * 0x9e3779b97f4a7c15ull);
+		if(v < f.signature[k]) f.signature[k] = v;
+	}
+}
+
+bool Fingerprint::compute(const BVH* bvh, Fingerprint& out) {
+	int frames = bvh->getFrames();
+	int parts = bvh->getPartCount();
+	if(frames < 1 || parts < 1) return false;
+
+	// Skeleton topology seeds both hashes, so different rigs never match
+	unsigned long long topology = bvh->getSkeleton()->getHash();
+	out.hash = combine(topology, frames);
+	for(int i=0; i<parts; ++i) {
+		const vec3& offset = bvh->getPart(i)->offset;
+		out.hash = combine(out.hash, quantise(offset.x, 1000));
+		out.hash = combine(out.hash, quantise(offset.y, 1000));
+		out.hash = combine(out.hash, quantise(offset.z, 1000));
+	}
+	for(int k=0; k<SIGNATURE; ++k) out.signature[k] = 0xffffffff;
+
+	float frameTime = bvh->getFrameTime() > 0? bvh->getFrameTime(): 1.0f / 30;
+	float nextPose = 0;
+	unsigned long long lastPose = 0;
+	int poses = 0;
+	Transform* pose = new Transform[parts];
+	for(int frame=0; frame<frames; ++frame) {
+		bvh->readFrames(frame, 1, pose);
+		bool sample = frame * frameTime >= nextPose;
+		unsigned long long coarse = topology;
+		for(int i=0; i<parts; ++i) {
+			// q and -q are the same rotation
+			Quaternion q = pose[i].rotation;
+			if(q.w < 0) q = Quaternion(-q.x, -q.y, -q.z, -q.w);
+			out.hash = combine(out.hash, quantise(q.x, fineSteps));
+			out.hash = combine(out.hash, quantise(q.y, fineSteps));
+			out.hash = combine(out.hash, quantise(q.z, fineSteps));
+			out.hash = combine(out.hash, quantise(pose[i].offset.x, 1000));
+			out.hash = combine(out.hash, quantise(pose[i].offset.y, 1000));
+			out.hash = combine(out.hash, quantise(pose[i].offset.z, 1000));
+			if(sample) {
+				coarse = combine(coarse, quantise(q.x, coarseSteps));
+				coarse = combine(coarse, quantise(q.y, coarseSteps));
+				coarse = combine(coarse, quantise(q.z, coarseSteps));
+			}
+		}
+		if(!sample) continue;
+
+		// Runs of two poses keep some ordering
+		nextPose += poseInterval;
+		if(poses > 0) addRun(out, combine(lastPose, coarse));
+		lastPose = coarse;
+		++poses;
+	}
+	delete [] pose;
+	// Clips too short for a run still need a signature
+	if(poses == 1) addRun(out, lastPose);
+	return true;
+}
+
+float Fingerprint::similarity(const Fingerprint& a, const Fingerprint& b) {
+	int same = 0;
+	for(int k=0; k<SIGNATURE; ++k) same += a.signature[k] == b.signature[k];
+	return (float)same / SIGNATURE;
+}
+
+// ------------------------------------------------- //
+
+/** Signature values per band. Files sharing any whole band are compared */
+static const int bandSize = 4;
+/** Files compared per band, so a huge bucket of near identical clips stays cheap */
+static const int bandLimit = 32;
+/** Signature similarity needed to count as the same take */
+static const float threshold = 0.75f;
+
+Duplicates::Duplicates() : m_clusters(0) {
+}
+
+void Duplicates::update(const Catalog& catalog) {
+	int count = catalog.size();
+	if((int)m_parent.size() < count) {
+		for(int i=m_parent.size(); i<count; ++i) m_parent.push_back(i);
+		m_size.resize(count, 1);
+		m_added.resize(count, 0);
+	}
+	Fingerprint f, other;
+	for(int i=0; i<count; ++i) {
+		if(m_added[i] || !catalog.getFingerprint(i, f)) continue;
+		m_added[i] = 1;
+
+		std::pair<std::unordered_map<unsigned long long, int>::iterator, bool> exact = m_hashes.insert( std::make_pair(f.hash, i) );
+		if(!exact.second) join(exact.first->second, i);
+
+		for(int b=0; b<Fingerprint::SIGNATURE; b+=bandSize) {
+			unsigned long long key = b;
+			for(int k=b; k<b+bandSize; ++k) key = combine(key, f.signature[k]);
+			std::vector<int>& bucket = m_bands[key];
+			for(size_t j=0; j<bucket.size() && j<(size_t)bandLimit; ++j) {
+				if(getGroup(bucket[j]) == getGroup(i)) continue;
+				catalog.getFingerprint(bucket[j], other);
+				if(Fingerprint::similarity(f, other) >= threshold) join(bucket[j], i);
+			}
+			bucket.push_back(i);
+		}
+	}
+}
+
+int Duplicates::getGroup(int i) {
+	if(i >= (int)m_parent.size()) return i;
+	int root = i;
+	while(m_parent[root] != root) root = m_parent[root];
+	while(m_parent[i] != root) {
+		int next = m_parent[i];
+		m_parent[i] = root;
+		i = next;
+	}
+	return root;
+}
+
+int Duplicates::getGroupSize(int i) {
+	if(i >= (int)m_parent.size()) return 1;
+	return m_size[ getGroup(i) ];
+}
+
+void Duplicates::join(int a, int b) {
+	a = getGroup(a);
+	b = getGroup(b);
+	if(a == b) return;
+	if(b < a) std::swap(a, b);
+	// The lowest index stays the root, so it is the file shown for the group
+	if(m_size[a] == 1) ++m_clusters;
+	if(m_size[b] > 1) --m_clusters;
+	m_parent[b] = a;
+	m_size[a] += m_size[b];
+}
+
+void Duplicates::report(const Catalog& catalog) {
+	std::unordered_map<int, std::vector<int> > groups;
+	for(int i=0; i<(int)m_parent.size(); ++i) {
+		if(getGroupSize(i) > 1) groups[ getGroup(i) ].push_back(i);
+	}
+	printf("%d duplicate groups\n", (int)groups.size());
+	for(int i=0; i<(int)m_parent.size(); ++i) {
+		std::unordered_map<int, std::vector<int> >::iterator it = groups.find(i);
+		if(it == groups.end()) continue;
+		printf("  %d copies:\n", (int)it->second.size());
+		for(size_t j=0; j<it->second.size(); ++j) {
+			int k = it->second[j];
+			printf("    %s/%s%s%s\n", catalog.getDirectory(k), catalog.getName(k), catalog.getArchive(k)? " in ": "", catalog.getArchive(k)? catalog.getArchivePath(catalog[k].archive): "");
+		}
+	}
+}
+
@@ -0,0 +1,52 @@
+#ifndef _DUPLICATES_
+#define _DUPLICATES_
+
+#include <vector>
+#include <unordered_map>
+
+class BVH;
+class Catalog;
+
+/** Hashes for spotting the same take saved more than once */
+struct Fingerprint {
+	enum { SIGNATURE = 16 };
+	unsigned long long hash;			// Hierarchy, offsets and every frame, quantised
+	unsigned signature[SIGNATURE];		// MinHash of short runs of coarse poses
+
+	/** Reads every frame, so only use on decoded clips or in the background */
+	static bool compute(const BVH* bvh, Fingerprint& out);
+	/** Fraction of signature values two fingerprints share. Estimates how much of their motion is the same */
+	static float similarity(const Fingerprint& a, const Fingerprint& b);
+};
+
+/** Groups catalog files with equal hashes, or with signatures that are close enough.
+ * Signatures are banded for locality sensitive hashing, so a file is only compared
+ * with the few others that share a band. */
+class Duplicates {
+	public:
+	Duplicates();
+	/** Group any files fingerprinted since the last call */
+	void update(const Catalog&);
+
+	/** The lowest index of the group a file belongs to */
+	int getGroup(int i);
+	/** Number of files in the group a file belongs to */
+	int getGroupSize(int i);
+	/** Number of groups with more than one file */
+	int getClusterCount() const           { return m_clusters; }
+	/** Print every group with more than one file */
+	void report(const Catalog&);
+
+	protected:
+	void join(int a, int b);
+
+	std::vector<int>  m_parent;		// Union find forest of files
+	std::vector<int>  m_size;		// Group sizes, valid at roots
+	std::vector<char> m_added;		// Files already grouped
+	std::unordered_map<unsigned long long, int> m_hashes;		// First file with each hash
+	std::unordered_map<unsigned long long, std::vector<int> > m_bands;	// Files sharing each band of their signature
+	int m_clusters;
+};
+
+#endif
+
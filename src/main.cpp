@@ -1,31 +1,42 @@
 #include <SDL2/SDL.h>
 #include <GL/gl.h>
+#ifdef LINUX
+#include <GL/glx.h>
+#endif
 #include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
 #include <vector>
 #include <string>
 #include <set>
+#include <map>
+#include <algorithm>
 
 #include "view.h"
 #include "directory.h"
 #include "thread.h"
-
-#include "miniz.c"
+#include "task.h"
+#include "zip.h"
+#include "catalog.h"
+#include "search.h"
+#include "motion.h"
+#include "duplicates.h"
+#include "scheduler.h"
+#include "overlay.h"
+#include "profile.h"
+#include "trace.h"
 
 using namespace base;
 
-struct FileEntry {
-	std::string directory;	// File directory or zip file
-	std::string name;		// File name
-	std::string archive;	// Directory is a zip file
-	int         zipIndex;	// Index of file in archive
-};
-
-struct LoadRequest {
-	FileEntry file;		// File to load
-	View*     view;		// Target view
+struct LoadSlot {
+	base::CancelToken        cancel;	// Cancels the latest request for the view
+	std::shared_future<void> done;		// Ready once that request has let go of its clip
 };
 
 enum AppMode { VIEW_SINGLE, VIEW_TILES };
+/** Whether frames may draw only the views that changed */
+enum RedrawMode { REDRAW_AUTO, REDRAW_FULL, REDRAW_PARTIAL };
 
 struct App {
 	SDL_Window* window;					// app window
@@ -35,13 +46,45 @@ struct App {
 	int         scrollOffset;			// Scroll offset in tile view
 	std::vector<View*> views;			// all views
 	std::set< std::string > paths;		// directorys - to avoid duplication
-	std::vector< FileEntry > files;		// all bvh files found
+	Catalog files;						// all bvh files found
 	int width, height;					// window size
 	int tileSize;						// tile size for tiled view
-
-	base::Thread loadThread;				// loading thread
-	base::Mutex  loadMutex;					// Loading mutex
-	std::vector<LoadRequest> loadQueue;		// Queue of views to be loaded
+	int loadFlags;						// BVH::LoadFlags for loaded files
+
+	base::Executor* executor;				// Workers for loading and per-frame view updates
+	base::Mutex     loadMutex;				// Guards loadSlots
+	std::map<View*, LoadSlot> loadSlots;	// Latest load request of each view
+
+	std::vector<View*> updateList;			// Views to update this frame
+	std::vector<int>   loadList;			// Visible views still to be loaded
+	UpdateScheduler    scheduler;			// Pose rates of visible views
+	int                redraw;				// Frames left that clear and draw the whole window
+	RedrawMode         redrawMode;			// From --full-redraw and --partial-redraw
+	bool               partialRedraw;		// This frame only draws the tiles that changed
+	bool               vsync;				// Pace frames by the display, not targetFps
+	int                targetFps;			// Frame rate limit without vsync
+	Overlay            overlay;				// Frame rate and latency display
+
+	std::vector<int> order;					// Files shown as tiles, after filtering
+	CatalogSearch    search;				// Index used by the filter
+	std::string      filter;				// Filter query
+	bool             editingFilter;			// Typing goes to the filter
+	bool             filterUsesInfo;		// Filter results change as clip info is read
+	int              filterScanned;			// infoScanned when the filter was last run
+	CancelToken      infoCancel;			// Stops the header scan and motion analysis
+	int              infoQueued;			// Files queued for the header scan
+	std::atomic<int> infoScanned;			// Files whose headers or motion have been read
+
+	int              similarTo;				// File whose similar clips are shown, or -1
+	MotionIndex      motionIndex;			// Nearest neighbour index of motion features
+	int              motionIndexed;			// infoScanned when motionIndex was built
+	int              featuresQueued;		// Files queued for motion analysis
+	int              fingerprintsQueued;	// Files queued for duplicate detection
+	std::atomic<int> fingerprinted;			// Files the duplicate pass has finished with
+	bool             reported;				// Duplicate groups printed since the pass finished
+	bool             collapse;				// Show one file of each duplicate group
+	bool             groupByRig;			// Order tiles by skeleton
+	Duplicates       duplicates;
 } app;
 
 // -------------------------------------------------------------------------------------- //
@@ -65,42 +108,20 @@ inline std::string getDirectory(const char* path) {
 // -------------------------------------------------------------------------------------- //
 
 void addFile(const char* f) {
-	FileEntry file;
-	file.name = getName(f);
-	file.directory = getDirectory(f);
-	app.files.push_back(file);
+	app.files.addFile(f);
 	printf("File: %s\n", f);
 }
 int addZip(const char* f) {
-	mz_zip_archive zipFile;
-	memset(&zipFile, 0, sizeof(zipFile));
-	mz_bool status = mz_zip_reader_init_file(&zipFile, f, 0);
-	if(!status) {
+	if(app.files.hasArchive(f)) return 0;
+	ZipArchive* zip = new ZipArchive();
+	if(!zip->open(f, ".bvh")) {
 		printf("Failed to open zip file %s\n", f);
+		delete zip;
 		return -1;
 	}
-	// read directory info
-	int files = mz_zip_reader_get_num_files(&zipFile);
-	for(int i=0; i<files; ++i) {
-		mz_zip_archive_file_stat stat;
-		if(mz_zip_reader_file_stat(&zipFile, i, &stat)) {
-			if( endsWith(stat.m_filename, ".bvh") ) {
-				printf("File %s\n", stat.m_filename);
-				FileEntry file;
-				file.directory = getDirectory(stat.m_filename);
-				file.name = getName(stat.m_filename);
-				file.archive = f;
-				file.zipIndex = i;
-				app.files.push_back(file);
-			}
-		} else {
-			printf("Failed to get file info from archive %s\n", f);
-			mz_zip_reader_end(&zipFile);
-			return -1;
-		}
-	}
-
-	mz_zip_reader_end(&zipFile);
+	// Only .bvh entries were kept
+	app.files.addArchive(zip);
+	printf("%d files in %s\n", zip->getEntryCount(), f);
 	return 0;
 }
 void addDirectory(const char* dir, bool recursive) {
@@ -124,108 +145,199 @@ void addDirectory(const char* dir, bool recursive) {
 
 // -------------------------------------------------------------------------------------- //
 
-BVH* loadFile(const FileEntry& file) {
+/** Large files are shown once the first block is decoded and stream in the rest */
+static const size_t streamThreshold = 8 << 20;
+int getLoadFlags(size_t size) {
+	int flags = app.loadFlags;
+	if(size > streamThreshold && !(flags & (BVH::REDUCE | BVH::COMPRESS | BVH::LAZY))) flags |= BVH::STREAM;
+	return flags;
+}
+
+/** Read a whole file into a malloc'd, null terminated buffer */
+char* readFile(const Catalog::Source& file, size_t& size) {
+	if(file.archive) {
+		// Archives are opened up front and only read here, so loads can share them
+		return file.archive->extract(file.zipIndex, &size);
+	}
+	TraceScope trace("read");
+	FILE* fp = fopen(file.path.c_str(), "r");
+	if(!fp) return 0;
+	fseek(fp, 0, SEEK_END);
+	int len = ftell(fp);
+	rewind(fp);
+	char* content = (char*)malloc(len+1);
+	fread(content, 1, len, fp);
+	content[len] = 0;
+	fclose(fp);
+	size = len;
+	return content;
+}
+
+BVH* loadFile(const Catalog::Source& file) {
+	ProfileScope profile(PROFILE_LOAD);
 	printf("Load %s\n", file.name.c_str());
-	if(file.archive.empty()) {
-		std::string filename = file.directory + "/" + file.name;
-		FILE* fp = fopen(filename.c_str(), "r");
-		if(!fp) { printf("Failed\n"); return 0; }
-		fseek(fp, 0, SEEK_END);
-		int len = ftell(fp);
-		rewind(fp);
-		char* content = new char[len+1];
-		fread(content, 1, len, fp);
-		content[len] = 0;
-		fclose(fp);
-		// Read bvh
-		BVH* bvh = new BVH();
-		int r = bvh->load(content);
-		if(r) return bvh;
-		else {
-			printf("Error loading %s\n", filename.c_str());
-			delete bvh;
-		}
-		return 0;
+	size_t size;
+	char* content = readFile(file, size);
+	if(!content) { printf("Failed\n"); return 0; }
+	// Read bvh. Lazy clips keep the text
+	BVH* bvh = new BVH();
+	int flags = getLoadFlags(size);
+	int r;
+	{
+		TraceScope trace("parse");
+		r = bvh->load(content, flags);
 	}
-	else {
-		bool result = false;
-		mz_zip_archive zipFile;
-		memset(&zipFile, 0, sizeof(zipFile));
-		mz_bool status = mz_zip_reader_init_file(&zipFile, file.archive.c_str(), 0);
-		if(!status) return 0;
-		BVH* bvh = 0;
-		size_t size;
-		void* p = mz_zip_reader_extract_to_heap(&zipFile, file.zipIndex, &size, 0);
-		if(p) {
-			((char*)p)[size-1] = 0;
-			bvh = new BVH();
-			result = bvh->load((const char*)p);
-			if(!result) { delete bvh; bvh = 0; }
-			mz_free(p);
+	if(!(flags & (BVH::LAZY | BVH::STREAM))) free(content);
+	if(r) return bvh;
+	printf("Error loading %s\n", file.name.c_str());
+	delete bvh;
+	return 0;
+}
+
+enum Analysis { ANALYSE_FEATURES=1, ANALYSE_FINGERPRINT=2 };
+
+/** Record the info, motion features and fingerprint of a clip, as far as asked */
+void recordClip(int index, const BVH* bvh, int analysis) {
+	app.files.setInfo(index, bvh->getFrames(), bvh->getPartCount(), bvh->getFrameTime(), bvh->getSkeleton()->getRig());
+	MotionFeatures features;
+	if((analysis & ANALYSE_FEATURES) && !app.files.hasFeatures(index) && MotionFeatures::compute(bvh, features)) {
+		app.files.setFeatures(index, features.value);
+	}
+	Fingerprint fingerprint;
+	if((analysis & ANALYSE_FINGERPRINT) && !app.files.hasFingerprint(index) && Fingerprint::compute(bvh, fingerprint)) {
+		app.files.setFingerprint(index, fingerprint);
+	}
+}
+
+/** Read a file for its features or fingerprint without showing it. Lazy loading only
+ * parses the frames used */
+bool analyseFile(int index, int analysis) {
+	size_t size;
+	char* content = readFile(app.files.getSource(index), size);
+	if(!content) return false;
+	BVH bvh;
+	if(!bvh.load(content, BVH::LAZY)) return false;
+	recordClip(index, &bvh, analysis);
+	return true;
+}
+
+void loadTask(int index, const Catalog::Source& file, View* view, CancelToken cancel, std::shared_future<void> previous, unsigned long long traceId) {
+	if(cancel.cancelled()) return;
+	view->setState(View::LOADING);
+	BVH* bvh = loadFile(file);
+	// Fingerprints read every frame, which is only cheap once they are decoded
+	if(bvh) recordClip(index, bvh, bvh->getDecodedFrames() == bvh->getFrames()? ANALYSE_FEATURES | ANALYSE_FINGERPRINT: ANALYSE_FEATURES);
+
+	// An earlier request may still be streaming into the clip this one replaces
+	if(previous.valid()) previous.wait();
+	if(cancel.cancelled()) {
+		delete bvh;
+		return;
+	}
+	view->publish(bvh, file.name.c_str());
+	Trace::asyncStep("load", traceId, "published");
+
+	// The view keeps this clip until our replacement waits for us, so it is safe to decode into
+	// Playback decodes the block it reaches itself, and decodeFrames() skips blocks claimed
+	// like that, so keep our own place rather than going back to the decoded prefix
+	static const int chunk = 16 * BVH::BLOCK_SIZE;
+	int next = 0;
+	while(bvh && bvh->isStreaming() && !cancel.cancelled() && bvh->getDecodedFrames() < bvh->getFrames()) {
+		if(next < bvh->getDecodedFrames()) next = bvh->getDecodedFrames();
+		if(next < bvh->getFrames()) {
+			bvh->decodeFrames(next, chunk);
+			next += chunk;
 		}
-		mz_zip_reader_end(&zipFile);
-		return bvh;
+		else Thread::sleep(1);	// Only blocks other threads are decoding are left
 	}
 }
 
-void requestLoad(const FileEntry& file, View* v) {
-	MutexLock lock(app.loadMutex);
-	LoadRequest r;
-	r.file = file;
-	r.view = v;
-	app.loadQueue.push_back(r);
-	v->setText( file.name.c_str() );
+struct LoadJob {
+	int                index;		// Catalog index
+	Catalog::Source    file;
+	View*              view;
+	CancelToken        cancel;
+	std::shared_future<void> previous;	// Earlier request for the same view
+	std::promise<void> done;
+	unsigned long long traceId;		// Ties together the trace events of the request
+};
+
+/** Replace the view's current request with a new one. Call with loadMutex held */
+LoadJob* createLoadJob(int file, View* v) {
+	v->setText( app.files.getName(file) );
 	v->setState( View::QUEUED );
 
+	LoadSlot& slot = app.loadSlots[v];
+	slot.cancel.cancel();
+	LoadJob* job = new LoadJob;
+	job->index = file;
+	job->file = app.files.getSource(file);
+	job->view = v;
+	job->previous = slot.done;
+	slot.cancel = job->cancel;
+	slot.done = job->done.get_future().share();
+	static unsigned long long jobs = 0;
+	job->traceId = ++jobs;
+	Trace::asyncBegin("load", job->traceId);
+	return job;
 }
-void cancelLoad(View* v) {
-	MutexLock lock(app.loadMutex);
-	for(size_t i=0; i<app.loadQueue.size(); ++i) {
-		if(app.loadQueue[i].view == v) {
-			app.loadQueue.erase( app.loadQueue.begin()+i);
-			v->setState( View::EMPTY );
-			break;
+void runLoadJob(LoadJob* job) {
+	Trace::asyncStep("load", job->traceId, "pickup");
+	{
+		TraceScope trace("loadTask");
+		loadTask(job->index, job->file, job->view, job->cancel, job->previous, job->traceId);
+	}
+	Trace::asyncEnd("load", job->traceId);
+	job->done.set_value();
+	delete job;
+}
+
+/** Load files into the views with the same indices. Files in the same archive are
+ * extracted and parsed in parallel by one task, so a screen of tiles from a zip
+ * is spread over every worker */
+void requestLoads(const std::vector<int>& indices) {
+	if(indices.empty()) return;
+	TraceScope trace("requestLoads");
+	std::map< int, std::vector<LoadJob*> > groups;
+	{
+		MutexLock lock(app.loadMutex);
+		for(size_t i=0; i<indices.size(); ++i) {
+			int k = indices[i];
+			groups[ app.files[k].archive ].push_back( createLoadJob(k, app.views[k]) );
 		}
 	}
+	for(std::map< int, std::vector<LoadJob*> >::iterator it=groups.begin(); it!=groups.end(); ++it) {
+		std::vector<LoadJob*> jobs;
+		jobs.swap(it->second);
+		app.executor->submit([jobs]() {
+			app.executor->parallelFor(jobs.size(), [&jobs](int i) { runLoadJob(jobs[i]); });
+		});
+	}
+}
+void cancelLoad(View* v) {
+	MutexLock lock(app.loadMutex);
+	std::map<View*, LoadSlot>::iterator it = app.loadSlots.find(v);
+	if(it == app.loadSlots.end()) return;
+	it->second.cancel.cancel();
+	if(v->getState() == View::QUEUED || v->getState() == View::LOADING) v->setState( View::EMPTY );
 }
 void cancelAll() {
 	MutexLock lock(app.loadMutex);
-	for(size_t i=0; i<app.loadQueue.size(); ++i) {
-		app.loadQueue[i].view->setState( View::EMPTY );
-	}
-	app.loadQueue.clear();
-}
-void loadThreadFunc(bool* running) {
-	printf("Load thread started\n");
-	while(*running) {
-		LoadRequest next;
-		next.view = 0;
-		{
-			MutexLock lock(app.loadMutex);
-			if(!app.loadQueue.empty()) {
-				next = app.loadQueue.front();
-				app.loadQueue.erase(app.loadQueue.begin());
-			}
-		}
-		if(next.view) {
-			next.view->setState(View::LOADING);
-			BVH* bvh = loadFile(next.file);
-			next.view->setBVH(bvh, next.file.name.c_str());
-			next.view->autoZoom();
-			next.view->setState(bvh? View::LOADED: View::INVALID);
-		}
-		Thread::sleep(10);
+	for(std::map<View*, LoadSlot>::iterator it = app.loadSlots.begin(); it != app.loadSlots.end(); ++it) {
+		View* v = it->first;
+		it->second.cancel.cancel();
+		if(v->getState() == View::QUEUED || v->getState() == View::LOADING) v->setState( View::EMPTY );
 	}
-	printf("Load thread ended\n");
 }
 
 // -------------------------------------------------------------------------------------- //
 
-bool exportFile(const FileEntry& file) {
-	printf("Exporting %s\n", file.name.c_str());
-	const char* outFile = file.name.c_str();
-	if(file.archive.empty()) {
-		std::string filename = file.directory + "/" + file.name;
+bool exportFile(int index) {
+	const char* outFile = app.files.getName(index);
+	printf("Exporting %s\n", outFile);
+	ZipArchive* zip = app.files.getArchive(index);
+	if(!zip) {
+		std::string filename = app.files.getPath(index);
 		FILE* fp = fopen(filename.c_str(), "r");
 		if(!fp) { printf("Failed\n"); return false; }
 		fseek(fp, 0, SEEK_END);
@@ -241,13 +353,7 @@ bool exportFile(const FileEntry& file) {
 		return fp;
 	}
 	else {
-		mz_zip_archive zipFile;
-		memset(&zipFile, 0, sizeof(zipFile));
-		mz_bool status = mz_zip_reader_init_file(&zipFile, file.archive.c_str(), 0);
-		if(!status) return false;
-		mz_zip_reader_extract_to_file(&zipFile, file.zipIndex, outFile, MZ_ZIP_FLAG_IGNORE_PATH);
-		mz_zip_reader_end(&zipFile);
-		return true;
+		return zip->extractToFile(app.files[index].zipIndex, outFile);
 	}
 }
 
@@ -256,6 +362,7 @@ bool exportFile(const FileEntry& file) {
 void mainLoop();
 void createViews();
 void setupTiles(bool smooth);
+void applyFilter(bool scroll);
 void setLayout(AppMode layout);
 
 int main(int argc, char* argv[]) {
@@ -265,13 +372,48 @@ int main(int argc, char* argv[]) {
 		"Distributed under GPL\n");
 	
 	app.activeIndex = -1;
+	app.similarTo = -1;
 	app.mode = VIEW_SINGLE;
 	app.scrollOffset = 0;
+	app.loadFlags = 0;
+	app.redraw = View::SWAP_BUFFERS;
+	app.redrawMode = REDRAW_AUTO;
+	app.partialRedraw = false;
+	app.vsync = false;
+	app.targetFps = 100;
 	
 	// Parse arguments
 	for(int i=1; i<argc; ++i) {
+		// Options
+		if(strcmp(argv[i], "--compress") == 0) {
+			app.loadFlags |= BVH::COMPRESS;
+		}
+		else if(strcmp(argv[i], "--reduce") == 0) {
+			app.loadFlags |= BVH::REDUCE;
+		}
+		else if(strcmp(argv[i], "--lazy") == 0) {
+			app.loadFlags |= BVH::LAZY;
+		}
+		else if(strcmp(argv[i], "--full-redraw") == 0) {
+			app.redrawMode = REDRAW_FULL;
+		}
+		else if(strcmp(argv[i], "--partial-redraw") == 0) {
+			app.redrawMode = REDRAW_PARTIAL;
+		}
+		else if(strcmp(argv[i], "--vsync") == 0) {
+			app.vsync = true;
+		}
+		else if(strcmp(argv[i], "--trace") == 0 && i+1 < argc) {
+			Trace::start(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--fps") == 0 && i+1 < argc) {
+			app.targetFps = atoi(argv[++i]);
+			if(app.targetFps < 1) app.targetFps = 1;
+			if(app.targetFps > 1000) app.targetFps = 1000;
+		}
+
 		// valid: bvh, zip, directory
-		if(isDirectory(argv[i])) {
+		else if(isDirectory(argv[i])) {
 			addDirectory( argv[i], true );
 
 		} else if(endsWith(argv[i], ".zip")) {
@@ -282,13 +424,8 @@ int main(int argc, char* argv[]) {
 			addDirectory(dir.c_str(), false);
 
 			// Initial index
-			const char* name = getName(argv[i]);
-			for(size_t j=0; j<app.files.size(); ++j) {
-				if(app.files[j].name == name) {
-					app.activeIndex = j;
-					break;
-				}
-			}
+			int index = app.files.find( getName(argv[i]) );
+			if(index >= 0) app.activeIndex = index;
 		}
 	}
 
@@ -316,27 +453,45 @@ int main(int argc, char* argv[]) {
 	}
 
 	SDL_GL_CreateContext(app.window);
+	if(app.vsync && SDL_GL_SetSwapInterval(1) < 0) {
+		printf("Vsync not available, limiting to %d fps\n", app.targetFps);
+		app.vsync = false;
+	}
+	if(!app.vsync) SDL_GL_SetSwapInterval(0);
 
 	glEnable(GL_DEPTH_TEST);
 
 	// Load font
 	View::setFont("/usr/share/fonts/truetype/DejaVuSans.ttf", 16);	// ick - seems there is no search.
+	app.overlay.setFont("/usr/share/fonts/truetype/DejaVuSans.ttf", 14);
+	{
+		char pacing[64];
+		if(app.vsync) snprintf(pacing, sizeof(pacing), "pacing: vsync");
+		else snprintf(pacing, sizeof(pacing), "pacing: %d fps", app.targetFps);
+		app.overlay.setLine(Overlay::LINE_USER, pacing);
+	}
 
 	// Set up views
 	createViews();
+	applyFilter(false);
+	SDL_StopTextInput();
+	// Keep at least one worker so loading never runs on the render thread
+	int cores = std::thread::hardware_concurrency();
+	app.executor = new Executor(cores > 2? cores - 1: 1, "worker");
 
 	// Initial single mode
 	if(app.activeIndex >= 0) {
 		app.activeView = app.views[app.activeIndex];
 		app.activeView->resize(0, 0, app.width, app.height, false);
 		app.activeView->setVisible(true);
+		app.activeView->setTimeline(true);
 		// Load files
+		std::vector<int> load;
 		for(int i=0; i<4; ++i) {
 			int k = (app.activeIndex + i) % app.views.size();
-			if(app.views[k]->getState() == View::EMPTY) {
-				requestLoad(app.files[k], app.views[k]);
-			}
+			if(app.views[k]->getState() == View::EMPTY) load.push_back(k);
 		}
+		requestLoads(load);
 	} else {
 		setLayout(VIEW_TILES);
 		setupTiles(false);
@@ -345,20 +500,53 @@ int main(int argc, char* argv[]) {
 
 	mainLoop();
 
+	app.infoCancel.cancel();
+	cancelAll();
+	delete app.executor;
+	Trace::stop();
 	return 0;
 
 }
 
 void createViews() {
-	for(size_t i=app.views.size(); i<app.files.size(); ++i) {
+	for(int i=app.views.size(); i<app.files.size(); ++i) {
 		app.views.push_back( new View(0,0,1,1) );
 	}
 }
 
+/** Clear and draw the whole window into every buffer, for changes that are not inside one view */
+void redrawAll() {
+	app.redraw = View::SWAP_BUFFERS;
+}
+
+/** Frames since the back buffer was last drawn, from GLX_EXT_buffer_age.
+ * 0 if its contents are undefined, -1 if the driver does not say */
+int getBufferAge() {
+	#ifdef LINUX
+	static int supported = -1;
+	Display* display = glXGetCurrentDisplay();
+	if(!display) return -1;		// Not GLX, such as Wayland
+	if(supported < 0) {
+		const char* extensions = glXQueryExtensionsString(display, DefaultScreen(display));
+		supported = extensions && strstr(extensions, "GLX_EXT_buffer_age");
+	}
+	if(!supported) return -1;
+	unsigned age = 0;
+	glXQueryDrawable(display, glXGetCurrentDrawable(), GLX_BACK_BUFFER_AGE_EXT, &age);
+	return age;
+	#else
+	return -1;
+	#endif
+}
+
 void setupTiles(bool smooth) {
+	redrawAll();
 	int columns = app.width / app.tileSize;
 	for(size_t i=0; i<app.views.size(); ++i) {
-		View* view = app.views[i];
+		app.views[i]->setVisible(false);
+	}
+	for(size_t i=0; i<app.order.size(); ++i) {
+		View* view = app.views[ app.order[i] ];
 		int x = i % columns * app.tileSize;
 		int y = app.height - app.tileSize - i / columns * app.tileSize - app.scrollOffset;
 		view->resize(x, y, app.tileSize, app.tileSize, smooth);
@@ -366,6 +554,151 @@ void setupTiles(bool smooth) {
 	}
 }
 
+// -------------------------------------------------------------------------------------- //
+
+/** Read the headers of every file in the background, so info tests can match files not loaded yet */
+void startInfoScan() {
+	static const int chunk = 512;
+	for(int first=app.infoQueued; first<app.files.size(); first+=chunk) {
+		int last = first + chunk < app.files.size()? first + chunk: app.files.size();
+		CancelToken cancel = app.infoCancel;
+		app.executor->submitBackground([first, last, cancel]() {
+			for(int i=first; i<last && !cancel.cancelled(); ++i) {
+				if(!app.files.hasInfo(i)) app.files.readInfo(i);
+			}
+			app.infoScanned.fetch_add(last - first, std::memory_order_relaxed);
+		});
+	}
+	app.infoQueued = app.files.size();
+}
+
+/** Work out the motion features or fingerprints of every file in the background, for
+ * finding similar clips and duplicates. Chunks run in parallel on the workers */
+void startAnalysis(int analysis) {
+	static const int chunk = 64;
+	int& queued = analysis == ANALYSE_FEATURES? app.featuresQueued: app.fingerprintsQueued;
+	for(int first=queued; first<app.files.size(); first+=chunk) {
+		int last = first + chunk < app.files.size()? first + chunk: app.files.size();
+		CancelToken cancel = app.infoCancel;
+		app.executor->submitBackground([first, last, cancel, analysis]() {
+			for(int i=first; i<last && !cancel.cancelled(); ++i) {
+				bool done = analysis == ANALYSE_FEATURES? app.files.hasFeatures(i): app.files.hasFingerprint(i);
+				if(!done) analyseFile(i, analysis);
+			}
+			app.infoScanned.fetch_add(last - first, std::memory_order_relaxed);
+			if(analysis == ANALYSE_FINGERPRINT) app.fingerprinted.fetch_add(last - first, std::memory_order_release);
+		});
+	}
+	queued = app.files.size();
+}
+
+/** Keep only the first file of each duplicate group in order */
+void collapseDuplicates() {
+	app.duplicates.update(app.files);
+	std::vector<char> shown(app.files.size(), 0);
+	size_t count = 0;
+	for(size_t i=0; i<app.order.size(); ++i) {
+		int group = app.duplicates.getGroup( app.order[i] );
+		if(shown[group]) continue;
+		shown[group] = 1;
+		app.order[count++] = app.order[i];
+	}
+	app.order.resize(count);
+
+	// Report once the whole library has been fingerprinted
+	if(!app.reported && app.fingerprinted.load(std::memory_order_acquire) >= app.fingerprintsQueued) {
+		app.duplicates.report(app.files);
+		app.reported = true;
+	}
+}
+
+/** Replace order with the clips most like app.similarTo, closest first, keeping only those in order */
+void findSimilar() {
+	static const int resultCount = 48;
+	float query[MotionFeatures::SIZE];
+	if(!app.files.getFeatures(app.similarTo, query)) {
+		// Not loaded or analysed yet. It is one file, so do it now
+		if(!analyseFile(app.similarTo, ANALYSE_FEATURES) || !app.files.getFeatures(app.similarTo, query)) {
+			printf("Cannot analyse %s\n", app.files.getName(app.similarTo));
+			app.similarTo = -1;
+			return;
+		}
+	}
+	startAnalysis(ANALYSE_FEATURES);
+
+	// Rebuild the index once more files have been analysed
+	int scanned = app.infoScanned.load(std::memory_order_relaxed);
+	if(app.motionIndex.size() == 0 || scanned != app.motionIndexed) {
+		std::vector<int> ids;
+		std::vector<float> points;
+		float features[MotionFeatures::SIZE];
+		for(int i=0; i<app.files.size(); ++i) {
+			if(!app.files.getFeatures(i, features)) continue;
+			ids.push_back(i);
+			points.insert(points.end(), features, features + MotionFeatures::SIZE);
+		}
+		app.motionIndex.build(ids, points.empty()? 0: &points[0]);
+		app.motionIndexed = scanned;
+	}
+
+	std::vector<char> allow(app.files.size(), 0);
+	for(size_t i=0; i<app.order.size(); ++i) allow[ app.order[i] ] = 1;
+	allow[app.similarTo] = 1;
+	app.motionIndex.nearest(query, resultCount, app.order, &allow);
+}
+
+void updateTitle() {
+	char buffer[512];
+	int length = snprintf(buffer, sizeof(buffer), "bvh-browser");
+	if(app.similarTo >= 0) {
+		length += snprintf(buffer + length, sizeof(buffer) - length, " - like %s", app.files.getName(app.similarTo));
+	}
+	if(app.collapse) {
+		length += snprintf(buffer + length, sizeof(buffer) - length, " - %d duplicate groups", app.duplicates.getClusterCount());
+	}
+	if(app.groupByRig) {
+		length += snprintf(buffer + length, sizeof(buffer) - length, " - %d rigs", Skeleton::getRigCount());
+	}
+	if(app.editingFilter || !app.filter.empty()) {
+		length += snprintf(buffer + length, sizeof(buffer) - length, " - filter: %s%s", app.filter.c_str(), app.editingFilter? "_": "");
+	}
+	if(app.similarTo >= 0 || app.collapse || app.groupByRig || app.editingFilter || !app.filter.empty()) {
+		snprintf(buffer + length, sizeof(buffer) - length, " (%d of %d)", (int)app.order.size(), app.files.size());
+	}
+	SDL_SetWindowTitle(app.window, buffer);
+}
+
+/** Choose which files are shown as tiles, and lay them out again */
+void applyFilter(bool scroll) {
+	if(app.filter.empty()) {
+		app.order.resize(app.files.size());
+		for(int i=0; i<app.files.size(); ++i) app.order[i] = i;
+		app.filterUsesInfo = false;
+	}
+	else {
+		app.filterUsesInfo = app.search.query(app.files, app.filter.c_str(), app.order);
+		if(app.filterUsesInfo) startInfoScan();
+	}
+	if(app.collapse) collapseDuplicates();
+	if(app.groupByRig) {
+		// Files are read in the background until every rig is known
+		startInfoScan();
+		std::vector<int> rigs(app.files.size());
+		int frames, joints, rig;
+		float frameTime;
+		for(size_t i=0; i<app.order.size(); ++i) {
+			int k = app.order[i];
+			rigs[k] = app.files.getInfo(k, frames, joints, frameTime, rig)? rig: 0x7fffffff;
+		}
+		std::stable_sort(app.order.begin(), app.order.end(), [&rigs](int a, int b) { return rigs[a] < rigs[b]; });
+	}
+	if(app.similarTo >= 0) findSimilar();
+	app.filterScanned = app.infoScanned.load(std::memory_order_relaxed);
+	if(scroll) app.scrollOffset = 0;
+	if(app.mode == VIEW_TILES) setupTiles(false);
+	if(app.window) updateTitle();
+}
+
 void setLayout(AppMode layout) {
 	switch(layout) {
 	case VIEW_SINGLE:	// Single view
@@ -373,22 +706,25 @@ void setLayout(AppMode layout) {
 			app.views[i]->setVisible(false);
 		}
 		app.activeView->setVisible(true);
+		app.activeView->setTimeline(true);
 		app.activeView->resize(0,0,app.width,app.height, true);
 		break;
 
 	case VIEW_TILES: // Tile view
+		if(app.activeView) app.activeView->setTimeline(false);
 		setupTiles(true);
 		break;
 	}
 	app.mode = layout;
+	redrawAll();
 }
 
 int getViewAt(int mx, int my) {
 	if(app.mode == VIEW_TILES) {
 		my = app.height - my;
-		for(size_t i=0; i<app.views.size(); ++i) {
-			if(app.views[i]->contains(mx, my)) {
-				return i;
+		for(size_t i=0; i<app.order.size(); ++i) {
+			if(app.views[ app.order[i] ]->contains(mx, my)) {
+				return app.order[i];
 			}
 		}
 	}
@@ -404,21 +740,65 @@ void selectView(int index) {
 }
 
 
+/** Show percentiles of each profiled subsystem in the overlay, or clear them if profiling is off */
+void updateProfileLines() {
+	char buffer[128];
+	int line = Overlay::LINE_USER + 1;
+	if(Profiler::isEnabled()) {
+		Profiler::collect();
+		for(int i=0; i<PROFILE_ZONES; ++i) {
+			ProfileZone zone = (ProfileZone)i;
+			Profiler::Stats stats = Profiler::getStats(zone);
+			if(stats.count) snprintf(buffer, sizeof(buffer), "%s   p50 %.2f   p95 %.2f   p99 %.2f ms", Profiler::getName(zone), stats.p50 * 1000, stats.p95 * 1000, stats.p99 * 1000);
+			else snprintf(buffer, sizeof(buffer), "%s   -", Profiler::getName(zone));
+			app.overlay.setLine(line++, buffer);
+		}
+		snprintf(buffer, sizeof(buffer), "queued tasks %d   memory %.1f MB", app.executor->getPending(), Profiler::getMemoryUsage() / 1048576.0);
+		app.overlay.setLine(line++, buffer);
+	}
+	while(line < Overlay::MAX_LINES) app.overlay.setLine(line++, "");
+}
+
+/** End a profiled phase of the main loop and start the next one */
+inline void endPhase(ProfileZone zone, unsigned long long& start) {
+	if(!start) return;
+	unsigned long long end = Profiler::now();
+	Profiler::record(zone, start, end);
+	start = end;
+}
+
 void mainLoop() {
 	bool running = true;
 	SDL_Event event;
 	uint ticks, lticks;
 	ticks = lticks = SDL_GetTicks();
 	bool rotate = false;
+	bool scrub = false;
 	bool moved = false;
 	int keyMask = 0;
 	int index = 0;
-
-	// start load thread
-	app.loadThread.begin(&loadThreadFunc, &running);
+	int idleWait = 0;	// Milliseconds to sleep waiting for input, when nothing is changing
+	Uint64 lastSwap = SDL_GetPerformanceCounter();
 
 	while(running) {
-		if(SDL_PollEvent(&event)) {
+		// Input: sleep if nothing is changing, then handle everything queued
+		bool received;
+		if(idleWait) {
+			received = SDL_WaitEventTimeout(&event, idleWait);
+			// Time spent asleep does not move anything on
+			ticks = SDL_GetTicks();
+			idleWait = 0;
+		}
+		else received = SDL_PollEvent(&event);
+		unsigned long long phase = Profiler::isActive()? Profiler::now(): 0;
+		unsigned long long frameStart = phase;
+
+		int wheel = 0;			// Wheel steps, applied together after the queue is empty
+		int scrubX = -1;		// Latest scrub position
+		bool refilter = false;	// Filter text changed
+		Uint32 inputTime = 0;	// When the oldest input handled this frame happened
+		for(; received; received = SDL_PollEvent(&event)) {
+			if(!inputTime && event.type != SDL_WINDOWEVENT && event.type != SDL_QUIT) inputTime = event.common.timestamp;
 			switch(event.type) {
 			case SDL_QUIT:
 				running = false;
@@ -426,6 +806,9 @@ void mainLoop() {
 
 			case SDL_WINDOWEVENT:
 				switch(event.window.event) {
+				case SDL_WINDOWEVENT_EXPOSED:
+					redrawAll();
+					break;
 				case SDL_WINDOWEVENT_RESIZED:
 				case SDL_WINDOWEVENT_SIZE_CHANGED:
 					app.width = event.window.data1;
@@ -447,6 +830,7 @@ void mainLoop() {
 				if(endsWith(event.drop.file, ".bvh")) {
 					addFile(event.drop.file);
 					createViews();
+					applyFilter(false);
 					selectView( app.views.size() - 1 );
 					app.activeView = app.views.back();
 					setLayout(VIEW_SINGLE);
@@ -456,34 +840,33 @@ void mainLoop() {
 
 			case SDL_MOUSEWHEEL:
 				moved = true;
-				if(app.mode == VIEW_TILES && (keyMask&3)) {
-					app.tileSize *= 1.0 + event.wheel.y * 0.1;
-					if(app.tileSize < 32) app.tileSize = 32;
-					if(app.tileSize > app.width) app.tileSize = app.width;
-					setupTiles(false);
-				}
-				else if(app.mode == VIEW_TILES && !rotate) {
-					int offset = event.wheel.y * 48;
-					if(offset>0 && app.scrollOffset >=0) break;
-
-					app.scrollOffset += offset;
-					for(size_t i=0; i<app.views.size(); ++i) {
-						app.views[i]->move(0, -offset);
-					}
-				}
-				else {
-					app.activeView->zoomView( 1.0 - event.wheel.y * 0.1);
-				}
+				wheel += event.wheel.y;
 				break;
 
 			case SDL_MOUSEBUTTONDOWN:
 				moved = false;
+				if(app.mode == VIEW_SINGLE && app.activeView->timelineContains(event.button.x, app.height - event.button.y)) {
+					scrub = true;
+					app.activeView->scrub(event.button.x);
+					break;
+				}
 				rotate = true;
 				index = getViewAt(event.button.x, event.button.y);
 				selectView(index);
 				break;
 
+			case SDL_MOUSEMOTION:
+				if(scrub) scrubX = event.motion.x;
+				break;
+
 			case SDL_MOUSEBUTTONUP:
+				if(scrub) {
+					if(scrubX >= 0) app.activeView->scrub(scrubX);
+					scrubX = -1;
+					scrub = false;
+					app.activeView->endScrub();
+					break;
+				}
 				rotate = false;
 				if(!moved && app.activeView) {
 					if(app.mode == VIEW_TILES) {
@@ -495,9 +878,59 @@ void mainLoop() {
 				}
 				break;
 
+			case SDL_TEXTINPUT:
+				if(app.editingFilter) {
+					app.filter += event.text.text;
+					refilter = true;
+				}
+				break;
+
 			case SDL_KEYDOWN:
+				// Filter text entry takes all keys
+				if(app.editingFilter) {
+					if(event.key.keysym.sym == SDLK_BACKSPACE && !app.filter.empty()) {
+						// Remove a whole utf-8 character
+						while(app.filter.size() > 1 && (app.filter[app.filter.size()-1] & 0xc0) == 0x80) app.filter.erase(app.filter.size()-1);
+						app.filter.erase(app.filter.size()-1);
+						refilter = true;
+					}
+					else if(event.key.keysym.sym == SDLK_RETURN || event.key.keysym.sym == SDLK_ESCAPE) {
+						if(event.key.keysym.sym == SDLK_ESCAPE) app.filter.clear();
+						app.editingFilter = false;
+						SDL_StopTextInput();
+						applyFilter(refilter);
+						refilter = false;
+					}
+					break;
+				}
+				if(event.key.keysym.sym == SDLK_SLASH && app.mode == VIEW_TILES) {
+					app.editingFilter = true;
+					SDL_StartTextInput();
+					updateTitle();
+					break;
+				}
+
+				if(event.key.keysym.sym == SDLK_F3) {
+					app.overlay.setVisible(!app.overlay.isVisible());
+					redrawAll();
+				}
+
+				if(event.key.keysym.sym == SDLK_F4) {
+					Profiler::setEnabled(!Profiler::isEnabled());
+					if(Profiler::isEnabled()) app.overlay.setVisible(true);
+					updateProfileLines();
+					redrawAll();
+				}
+
 				if(event.key.keysym.sym == SDLK_z) app.activeView->autoZoom();
 				if(event.key.keysym.sym == SDLK_SPACE) app.activeView->togglePause();
+				if(event.key.keysym.sym == SDLK_i) {
+					static const char* names[] = { "slerp", "nlerp", "fast slerp" };
+					View::Interpolation mode = (View::Interpolation)((View::getInterpolation() + 1) % 3);
+					View::setInterpolation(mode);
+					redrawAll();
+					printf("Interpolation: %s\n", names[mode]);
+				}
 
 				// Mask
 				if(event.key.keysym.sym == SDLK_LCTRL)  keyMask |= 0x01;
@@ -508,36 +941,80 @@ void mainLoop() {
 				if(event.key.keysym.sym == SDLK_RALT)   keyMask |= 0x20;
 
 				// Navigation
-				if(app.files.size() > 1 && app.mode == VIEW_SINGLE) {
+				if(app.order.size() > 1 && app.mode == VIEW_SINGLE) {
 					int m = 0;
 					if(event.key.keysym.sym == SDLK_LEFT) m = -1;
 					if(event.key.keysym.sym == SDLK_RIGHT) m = 1;
 					if(m != 0) {
-						int count = app.views.size();
-						index = (app.activeIndex + m + count) % count;
+						// Step through the files that pass the filter
+						int count = app.order.size();
+						int position = std::find(app.order.begin(), app.order.end(), app.activeIndex) - app.order.begin();
+						if(position == count) position = m > 0? -1: 0;
+						position = (position + m + count) % count;
+						index = app.order[position];
 						app.activeView->setVisible(false);
+						app.activeView->setTimeline(false);
 						selectView(index);
 						app.activeView->setVisible(true);
+						app.activeView->setTimeline(true);
 						app.activeView->resize(0,0,app.width,app.height, false);
 						// Load files (with look ahead)
+						std::vector<int> load;
 						for(int i=0; i<4; ++i) {
-							int k = (index + i) % count;
-							if(app.views[k]->getState() == View::EMPTY) {
-								requestLoad(app.files[k], app.views[k]);
-							}
+							int k = app.order[ (position + i) % count ];
+							if(app.views[k]->getState() == View::EMPTY) load.push_back(k);
 						}
+						requestLoads(load);
+					}
+				}
+
+				// Find clips that move like the active one
+				if(event.key.keysym.sym == SDLK_f && app.activeIndex >= 0 && app.activeIndex < app.files.size()) {
+					app.similarTo = app.activeIndex;
+					if(app.mode == VIEW_SINGLE) setLayout(VIEW_TILES);
+					applyFilter(true);
+				}
+
+				// Show one file of each group of duplicates
+				if(event.key.keysym.sym == SDLK_d) {
+					app.collapse = !app.collapse;
+					if(app.collapse) {
+						app.reported = false;
+						startAnalysis(ANALYSE_FINGERPRINT);
+					}
+					applyFilter(false);
+				}
+
+				// Skeletons: group tiles by rig, or show only the active clip's rig
+				if(event.key.keysym.sym == SDLK_g) {
+					app.groupByRig = !app.groupByRig;
+					applyFilter(false);
+				}
+				if(event.key.keysym.sym == SDLK_r && app.activeIndex >= 0 && app.activeIndex < app.files.size()) {
+					int frames, joints, rig;
+					float frameTime;
+					if(app.files.getInfo(app.activeIndex, frames, joints, frameTime, rig)) {
+						char query[32];
+						snprintf(query, sizeof(query), "rig=%d", rig);
+						app.filter = query;
+						if(app.mode == VIEW_SINGLE) setLayout(VIEW_TILES);
+						applyFilter(true);
 					}
 				}
 
 				// Escape
 				if(event.key.keysym.sym == SDLK_ESCAPE) {
 					if(app.mode == VIEW_SINGLE) setLayout(VIEW_TILES);
+					else if(app.similarTo >= 0) {
+						app.similarTo = -1;
+						applyFilter(true);
+					}
 					else running = false;
 				}
 
 				// Export test
 				if(event.key.keysym.sym == SDLK_s) {
-					exportFile(app.files[app.activeIndex]);
+					exportFile(app.activeIndex);
 				}
 
 				break;
@@ -556,68 +1033,190 @@ void mainLoop() {
 			}
 		}
 
-		else {
-			// Rotation
-			int mx, my;
-			SDL_GetRelativeMouseState(&mx, &my);
-			if(rotate) {
-				if(app.activeView) app.activeView->rotateView(-mx*0.01, my*0.01);
-				moved |= mx || my;
+		// Apply the input gathered over the frame
+		if(refilter) applyFilter(true);
+		if(scrub && scrubX >= 0) app.activeView->scrub(scrubX);
+		if(wheel) {
+			float steps = abs(wheel);
+			if(app.mode == VIEW_TILES && (keyMask&3)) {
+				app.tileSize *= pow(wheel > 0? 1.1: 0.9, steps);
+				if(app.tileSize < 32) app.tileSize = 32;
+				if(app.tileSize > app.width) app.tileSize = app.width;
+				setupTiles(false);
+			}
+			else if(app.mode == VIEW_TILES && !rotate) {
+				int offset = wheel * 48;
+				if(offset > 0 && app.scrollOffset + offset > 0) offset = app.scrollOffset < 0? -app.scrollOffset: 0;
+				if(offset) {
+					app.scrollOffset += offset;
+					for(size_t i=0; i<app.order.size(); ++i) {
+						app.views[ app.order[i] ]->move(0, -offset);
+					}
+					redrawAll();
+				}
+			}
+			else {
+				app.activeView->zoomView( pow(wheel > 0? 0.9: 1.1, steps) );
 			}
-			
+		}
 
-			
-			// Update all views
-			lticks = ticks;
-			ticks = SDL_GetTicks();
-			float time = (ticks - lticks) * 0.001; // ticks in miliseconds
+		// Rotation
+		int mx, my;
+		SDL_GetRelativeMouseState(&mx, &my);
+		if(rotate && (mx || my)) {
+			if(app.activeView) app.activeView->rotateView(-mx*0.01, my*0.01);
+			moved = true;
+		}
+		endPhase(PROFILE_EVENTS, phase);
 
+		// Update all views
+		lticks = ticks;
+		ticks = SDL_GetTicks();
+		float time = (ticks - lticks) * 0.001; // ticks in miliseconds
 
-			int count = 0;
-			switch(app.mode) {
-			case VIEW_SINGLE:
-				if(app.activeView) {
+		if(app.overlay.update(time)) updateProfileLines();
+
+		// Drawing only what changed needs a back buffer holding one of the last SWAP_BUFFERS frames.
+		// Without the buffer age that is only assumed when asked for, as some drivers swap more buffers
+		if(app.redrawMode == REDRAW_FULL) app.partialRedraw = false;
+		else {
+			int age = getBufferAge();
+			if(age < 0) app.partialRedraw = app.redrawMode == REDRAW_PARTIAL;
+			else app.partialRedraw = age > 0 && age <= View::SWAP_BUFFERS;
+		}
+		// Views drawn in part would need the overlay under them, and single mode always clears the window.
+		// Text that got shorter leaves old text outside its backing, which only a full redraw clears
+		if(app.overlay.needsRedraw() && (app.mode == VIEW_SINGLE || !app.partialRedraw || app.overlay.isShrinking())) redrawAll();
+
+		// Update and render
+		Uint64 workStart = SDL_GetPerformanceCounter();
+		bool drawn = false;
+		bool animating = false;
+		bool dirty = false;
+		switch(app.mode) {
+		case VIEW_SINGLE:
+			if(app.activeView) {
+				app.activeView->setPoseInterval(0);
+				app.activeView->update(time);
+				endPhase(PROFILE_UPDATE, phase);
+				app.activeView->updatePose();
+				endPhase(PROFILE_POSE, phase);
+				animating = app.activeView->isAnimating();
+				if(app.redraw || app.activeView->needsRedraw()) {
 					glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-					app.activeView->update(time);
 					app.activeView->render();
+					drawn = true;
 				}
-				break;
-			case VIEW_TILES:
-				// Update all visible views
-				for(size_t i=0; i<app.views.size(); ++i) {
-					View* view = app.views[i];
-					if(view->top() > app.height) continue;
-					if(view->bottom() <= 0) break;
-					if(view->getState() == View::EMPTY) {
-						requestLoad(app.files[i], view);
-					}
-					view->update(time);
-				}
+			}
+			break;
+		case VIEW_TILES:
+			// Update all visible views
+			app.updateList.clear();
+			app.loadList.clear();
+			for(size_t i=0; i<app.order.size(); ++i) {
+				View* view = app.views[ app.order[i] ];
+				if(view->top() > app.height) continue;
+				if(view->bottom() <= 0) break;
+				if(view->getState() == View::EMPTY) app.loadList.push_back(app.order[i]);
+				app.updateList.push_back(view);
+			}
+			requestLoads(app.loadList);
+
+			// Decide which views pose this frame
+			{
+				int mx, my;
+				SDL_GetMouseState(&mx, &my);
+				int hovered = getViewAt(mx, my);
+				app.scheduler.schedule(app.updateList, app.activeView, hovered >= 0? app.views[hovered]: 0);
+			}
+			for(size_t i=0; i<app.updateList.size(); ++i) app.updateList[i]->update(time);
+			endPhase(PROFILE_UPDATE, phase);
+
+			// Skeletons are independent, so evaluate them in parallel
+			app.executor->parallelFor(app.updateList.size(), [](int i) {
+				app.updateList[i]->updatePose();
+			});
+			endPhase(PROFILE_POSE, phase);
+
+			// Tiles sliding to new places leave gaps, so they redraw everything
+			for(size_t i=0; i<app.updateList.size(); ++i) {
+				animating |= app.updateList[i]->isAnimating();
+				dirty |= app.updateList[i]->needsRedraw();
+				if(app.updateList[i]->isMoving()) redrawAll();
+			}
 
-				// Render everything
+			if(app.redraw || (dirty && !app.partialRedraw)) {
 				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-				if(app.mode == VIEW_TILES) {
-					for(size_t i=0; i<app.views.size(); ++i) {
-						if(app.views[i]->top() > app.height) continue;
-						if(app.views[i]->bottom() <= 0) break;
-						if(app.views[i] != app.activeView) app.views[i]->render();
-						++count;
-					}
+				for(size_t i=0; i<app.updateList.size(); ++i) {
+					if(app.updateList[i] != app.activeView) app.updateList[i]->render();
 				}
-				if(app.activeView) app.activeView->render();
-				break;
+				if(app.activeView && app.activeView->isVisible()) app.activeView->render();
+				drawn = true;
+			}
+			else if(dirty) {
+				// Clear and draw only the tiles that changed. The rest of the back buffer
+				// still holds them from the frame before last
+				glEnable(GL_SCISSOR_TEST);
+				for(size_t i=0; i<app.updateList.size(); ++i) {
+					View* view = app.updateList[i];
+					if(!view->needsRedraw()) continue;
+					int x, y, w, h;
+					view->getRect(x, y, w, h);
+					glScissor(x, y, w, h);
+					glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+					view->render();
+					drawn = true;
+				}
+				glDisable(GL_SCISSOR_TEST);
+			}
+			break;
+		}
+		if(drawn || app.overlay.needsRedraw()) {
+			app.overlay.render(app.width, app.height);
+			drawn = true;
+		}
+		// Frames that draw nothing would hide the real render times
+		if(drawn) endPhase(PROFILE_RENDER, phase);
+		if(drawn && app.redraw > 0) --app.redraw;
+		app.scheduler.measured( (float)(SDL_GetPerformanceCounter() - workStart) / SDL_GetPerformanceFrequency() );
+
+		// Info tests pick up headers as the scan reads them
+		bool refresh = (app.filterUsesInfo || app.similarTo >= 0 || app.collapse || app.groupByRig) && app.infoScanned.load(std::memory_order_relaxed) != app.filterScanned;
+		if(refresh) {
+			static uint lastFilter = 0;
+			if(ticks - lastFilter > 250) {
+				applyFilter(false);
+				lastFilter = ticks;
 			}
+		}
 
-			// Limit to 60fps?
-			uint t = SDL_GetTicks() - ticks;
-			if(t < 10) SDL_Delay(10 - t);
-			else SDL_Delay(1);
+		// Present
+		if(drawn) {
+			{
+				ProfileScope profile(PROFILE_SWAP);
+				SDL_GL_SwapWindow(app.window);
+			}
+			Uint64 now = SDL_GetPerformanceCounter();
+			app.overlay.frame( (float)(now - lastSwap) / SDL_GetPerformanceFrequency() );
+			lastSwap = now;
+			if(inputTime) {
+				// Wait for the frame to finish so the latency shown includes drawing it
+				if(app.overlay.isVisible()) glFinish();
+				app.overlay.latency( (SDL_GetTicks() - inputTime) * 0.001f );
+			}
+		}
 
-			static char buffer[128];
-			sprintf(buffer, "%d %x\n", t, keyMask);
-			SDL_SetWindowTitle(app.window, buffer);
+		if(frameStart && drawn) Trace::span("frame", frameStart, Trace::now());
 
-			SDL_GL_SwapWindow(app.window);
+		// Pacing. Sleep until something happens when nothing is moving. Swapping nothing keeps both buffers valid
+		if(!drawn && !animating && !app.redraw) {
+			idleWait = refresh? 250: 500;
+		}
+		else if(!app.vsync || !drawn) {
+			// Vsync waits in the swap, otherwise wait for the frame's time slot
+			uint t = SDL_GetTicks() - ticks;
+			uint period = 1000 / app.targetFps;
+			if(t < period) SDL_Delay(period - t);
 		}
 	}
 }
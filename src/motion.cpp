@@ -0,0 +1,218 @@
+#include "motion.h"
+#include "bvh.h"
+#include <algorithm>
+#include <cstring>
+
+/** Bin edges for joint speeds relative to the root, and root ground speed, in skeleton lengths per second */
+static const float jointSpeeds[] = { 0.05f, 0.15f, 0.4f, 1.0f, 2.5f };
+static const float rootSpeeds[]  = { 0.1f, 0.5f, 1.5f };
+
+static int findBin(float v, const float* edges, int count) {
+	int bin = 0;
+	while(bin < count && v >= edges[bin]) ++bin;
+	return bin;
+}
+
+bool MotionFeatures::compute(const BVH* bvh, MotionFeatures& out) {
+	int frames = bvh->getFrames();
+	int parts = bvh->getPartCount();
+	if(frames < 1 || parts < 1) return false;
+	memset(out.value, 0, sizeof(out.value));
+	float* jointHistogram = out.value;	// 6 bins
+	float* rootHistogram = out.value + 6;	// 4 bins
+
+	// Skeleton size is the longest chain from the root, which does not depend on the pose
+	float* chain = new float[parts];
+	float scale = 0;
+	for(int i=0; i<parts; ++i) {
+		const BVH::Part* part = bvh->getPart(i);
+		int parent = bvh->getParent(i);
+		chain[i] = parent < 0? 0: chain[parent] + part->offset.length();
+		if(chain[i] > scale) scale = chain[i];
+	}
+	delete [] chain;
+	if(scale < 1e-4f) scale = 1;
+	float frameTime = bvh->getFrameTime() > 0? bvh->getFrameTime(): 1.0f / 30;
+
+	static const int maxSamples = 256;
+	int samples = frames < maxSamples? frames: maxSamples;
+	Transform* local = new Transform[parts];
+	Transform* world = new Transform[parts];
+	vec3* previous = new vec3[parts];
+	Quaternion previousRotation;
+	vec3 previousRoot;
+	int previousFrame = 0;
+	float heightSum = 0, heightSquares = 0, verticalSpeed = 0, turnRate = 0;
+	float extent = 0, spread = 0;
+	int moves = 0;
+	for(int s=0; s<samples; ++s) {
+		int frame = (int)((long long)s * frames / samples);
+		bvh->readFrames(frame, 1, local);
+		bvh->getWorldPose(local, world);
+		const vec3& root = world[0].offset;
+
+		// Pose shape, relative to the root
+		float low = 0, high = 0, wide = 0;
+		for(int i=0; i<parts; ++i) {
+			vec3 p = world[i].offset - root;
+			if(p.y < low) low = p.y;
+			if(p.y > high) high = p.y;
+			float r = sqrt(p.x*p.x + p.z*p.z);
+			if(r > wide) wide = r;
+		}
+		extent += (high - low) / scale;
+		spread += wide / scale;
+		heightSum += root.y / scale;
+		heightSquares += (root.y / scale) * (root.y / scale);
+
+		if(s > 0) {
+			float dt = (frame - previousFrame) * frameTime;
+			for(int i=1; i<parts; ++i) {
+				vec3 p = world[i].offset - root;
+				float speed = (p - previous[i]).length() / dt / scale;
+				jointHistogram[ findBin(speed, jointSpeeds, 5) ] += 1;
+			}
+			vec3 move = root - previousRoot;
+			float ground = sqrt(move.x*move.x + move.z*move.z) / dt / scale;
+			rootHistogram[ findBin(ground, rootSpeeds, 3) ] += 1;
+			verticalSpeed += fabs(move.y) / dt / scale;
+
+			const Quaternion& q = world[0].rotation;
+			float d = fabs(q.x*previousRotation.x + q.y*previousRotation.y + q.z*previousRotation.z + q.w*previousRotation.w);
+			turnRate += 2 * acos(d < 1? d: 1) / dt;
+			++moves;
+		}
+		for(int i=1; i<parts; ++i) previous[i] = world[i].offset - root;
+		previousRoot = root;
+		previousRotation = world[0].rotation;
+		previousFrame = frame;
+	}
+	delete [] local;
+	delete [] world;
+	delete [] previous;
+
+	// Histograms become fractions so clip length does not matter
+	float jointTotal = 0, rootTotal = 0;
+	for(int i=0; i<6; ++i) jointTotal += jointHistogram[i];
+	for(int i=0; i<4; ++i) rootTotal += rootHistogram[i];
+	for(int i=0; i<6 && jointTotal > 0; ++i) jointHistogram[i] /= jointTotal;
+	for(int i=0; i<4 && rootTotal > 0; ++i) rootHistogram[i] /= rootTotal;
+
+	float mean = heightSum / samples;
+	float variance = heightSquares / samples - mean * mean;
+	float seconds = frames * frameTime;
+	out.value[10] = sqrt(variance > 0? variance: 0);
+	out.value[11] = moves? std::min(verticalSpeed / moves, 2.0f) * 0.5f: 0;
+	out.value[12] = moves? std::min(turnRate / moves / 3.14159f, 1.0f): 0;
+	out.value[13] = extent / samples * 0.5f;
+	out.value[14] = spread / samples;
+	out.value[15] = std::min((float)(log(1 + seconds) / log(61.0)), 1.0f);
+	return true;
+}
+
+float MotionFeatures::distance(const float* a, const float* b) {
+	float d = 0;
+	for(int i=0; i<SIZE; ++i) d += (a[i] - b[i]) * (a[i] - b[i]);
+	return d;
+}
+
+// ------------------------------------------------- //
+
+/** Clips in a leaf are compared one by one */
+static const int leafSize = 8;
+
+struct MotionIndex::Search {
+	const float* query;
+	int k;
+	const std::vector<char>* allow;
+	std::vector< std::pair<float,int> > best;	// Max heap of the closest found so far
+};
+
+MotionIndex::MotionIndex() {
+}
+
+void MotionIndex::build(const std::vector<int>& ids, const float* points) {
+	int count = ids.size();
+	std::vector<int> order(count);
+	for(int i=0; i<count; ++i) order[i] = i;
+	m_nodes.clear();
+	m_nodes.reserve(2 * count / leafSize + 1);
+	if(count > 0) buildNode(order, points, 0, count);
+
+	// Store points in tree order so leaves are contiguous
+	m_ids.resize(count);
+	m_points.resize(count * MotionFeatures::SIZE);
+	for(int i=0; i<count; ++i) {
+		m_ids[i] = ids[ order[i] ];
+		memcpy(&m_points[i * MotionFeatures::SIZE], points + order[i] * MotionFeatures::SIZE, MotionFeatures::SIZE * sizeof(float));
+	}
+}
+
+int MotionIndex::buildNode(std::vector<int>& order, const float* points, int first, int count) {
+	int index = m_nodes.size();
+	m_nodes.push_back(Node());
+	Node node = { first, count, -1, 0, -1, -1 };
+	if(count > leafSize) {
+		// Split the widest axis at the median
+		float widest = 0;
+		for(int axis=0; axis<MotionFeatures::SIZE; ++axis) {
+			float low = points[ order[first] * MotionFeatures::SIZE + axis ], high = low;
+			for(int i=first+1; i<first+count; ++i) {
+				float v = points[ order[i] * MotionFeatures::SIZE + axis ];
+				if(v < low) low = v;
+				if(v > high) high = v;
+			}
+			if(high - low > widest) widest = high - low, node.axis = axis;
+		}
+		if(node.axis >= 0) {
+			int axis = node.axis;
+			int half = count / 2;
+			std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+				[points, axis](int a, int b) { return points[a * MotionFeatures::SIZE + axis] < points[b * MotionFeatures::SIZE + axis]; });
+			node.split = points[ order[first + half] * MotionFeatures::SIZE + axis ];
+			node.left = buildNode(order, points, first, half);
+			node.right = buildNode(order, points, first + half, count - half);
+		}
+	}
+	m_nodes[index] = node;
+	return index;
+}
+
+void MotionIndex::search(int index, Search& s) const {
+	const Node& node = m_nodes[index];
+	if(node.axis < 0) {
+		for(int i=node.first; i<node.first+node.count; ++i) {
+			if(s.allow && !(*s.allow)[ m_ids[i] ]) continue;
+			float d = MotionFeatures::distance(s.query, &m_points[i * MotionFeatures::SIZE]);
+			if((int)s.best.size() < s.k) {
+				s.best.push_back( std::make_pair(d, m_ids[i]) );
+				std::push_heap(s.best.begin(), s.best.end());
+			}
+			else if(d < s.best[0].first) {
+				std::pop_heap(s.best.begin(), s.best.end());
+				s.best.back() = std::make_pair(d, m_ids[i]);
+				std::push_heap(s.best.begin(), s.best.end());
+			}
+		}
+		return;
+	}
+	float offset = s.query[node.axis] - node.split;
+	search(offset < 0? node.left: node.right, s);
+	// The other side can only help if it is closer than the worst match so far
+	if((int)s.best.size() < s.k || offset * offset < s.best[0].first) {
+		search(offset < 0? node.right: node.left, s);
+	}
+}
+
+void MotionIndex::nearest(const float* query, int k, std::vector<int>& out, const std::vector<char>* allow) const {
+	out.clear();
+	if(m_nodes.empty() || k <= 0) return;
+	Search s;
+	s.query = query;
+	s.k = k;
+	s.allow = allow;
+	search(0, s);
+	std::sort_heap(s.best.begin(), s.best.end());
+	for(size_t i=0; i<s.best.size(); ++i) out.push_back(s.best[i].second);
+}
+
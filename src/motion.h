@@ -0,0 +1,51 @@
+#ifndef _MOTION_
+#define _MOTION_
+
+#include <vector>
+
+class BVH;
+
+/** Fixed size summary of how a clip moves, so clips can be compared whatever their skeleton.
+ * Speeds and sizes are measured in skeleton lengths, so scale and units do not matter. */
+struct MotionFeatures {
+	enum { SIZE = 16 };
+	float value[SIZE];
+
+	/** Sample up to 256 frames of a clip. Works on LAZY clips without decoding them */
+	static bool compute(const BVH* bvh, MotionFeatures& out);
+	/** Squared distance between two feature vectors */
+	static float distance(const float* a, const float* b);
+};
+
+/** k-d tree over feature vectors, for finding the clips nearest a query */
+class MotionIndex {
+	public:
+	MotionIndex();
+	/** Rebuild the tree. Points are copied
+	 * @param ids     Catalog index of each point
+	 * @param points  MotionFeatures::SIZE values per point */
+	void build(const std::vector<int>& ids, const float* points);
+	int  size() const { return m_ids.size(); }
+
+	/** Find the nearest points to a query, closest first
+	 * @param allow   Only return ids with allow[id] set, or null for any */
+	void nearest(const float* query, int k, std::vector<int>& out, const std::vector<char>* allow=0) const;
+
+	protected:
+	struct Node {
+		int   first, count;	// Range of points in this subtree
+		int   axis;			// Split axis, or -1 for leaves
+		float split;
+		int   left, right;	// Child nodes
+	};
+	struct Search;
+	int  buildNode(std::vector<int>& order, const float* points, int first, int count);
+	void search(int node, Search& s) const;
+
+	std::vector<Node>  m_nodes;
+	std::vector<int>   m_ids;
+	std::vector<float> m_points;
+};
+
+#endif
+
@@ -0,0 +1,149 @@
+#include "overlay.h"
+#include "view.h"
+#include "profile.h"
+#include <SDL_opengl.h>
+#include <SDL_ttf.h>
+#include <cstdio>
+
+static TTF_Font* overlayFont = 0;
+
+/** Seconds between rebuilding the statistics lines */
+static const float refreshInterval = 0.5f;
+
+Overlay::Overlay() : m_visible(false), m_damage(0), m_boxWidth(0), m_boxHeight(0), m_age(0) {
+	for(int i=0; i<MAX_LINES; ++i) {
+		m_lines[i].texture = 0;
+		m_lines[i].width = m_lines[i].height = 0;
+	}
+	m_frames = m_inputs = 0;
+	m_frameTotal = m_frameMax = 0;
+	m_latencyTotal = m_latencyMax = 0;
+}
+
+void Overlay::setFont(const char* fontName, int size) {
+	if(!TTF_WasInit()) TTF_Init();
+	overlayFont = TTF_OpenFont(fontName, size);
+	if(!overlayFont) printf("Failed to load font %s\n", fontName);
+}
+
+void Overlay::setVisible(bool v) {
+	m_visible = v;
+	m_damage = View::SWAP_BUFFERS;
+}
+
+void Overlay::frame(float interval) {
+	++m_frames;
+	m_frameTotal += interval;
+	if(interval > m_frameMax) m_frameMax = interval;
+}
+
+void Overlay::latency(float seconds) {
+	++m_inputs;
+	m_latencyTotal += seconds;
+	if(seconds > m_latencyMax) m_latencyMax = seconds;
+}
+
+void Overlay::setLine(int line, const char* text) {
+	if(line < 0 || line >= MAX_LINES || m_lines[line].text == text) return;
+	Line& l = m_lines[line];
+	l.text = text;
+	m_damage = View::SWAP_BUFFERS;
+	if(!overlayFont || l.text.empty()) {
+		l.width = l.height = 0;
+		return;
+	}
+
+	ProfileScope profile(PROFILE_TEXT);
+	if(!l.texture) glGenTextures(1, &l.texture);
+	glBindTexture(GL_TEXTURE_2D, l.texture);
+	SDL_Colour colour;
+	colour.r = colour.g = colour.b = 255;
+	SDL_Surface* s = TTF_RenderText_Blended(overlayFont, text, colour);
+	l.width  = s->w;
+	l.height = s->h;
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, s->w, s->h, 0, GL_BGRA, GL_UNSIGNED_BYTE, s->pixels);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	SDL_FreeSurface(s);
+}
+
+bool Overlay::update(float time) {
+	m_age += time;
+	if(m_age < refreshInterval || !m_visible) return false;
+
+	char buffer[128];
+	if(m_frames) snprintf(buffer, sizeof(buffer), "%.0f fps   %.1f ms   max %.1f ms", m_frames / m_age, m_frameTotal / m_frames * 1000, m_frameMax * 1000);
+	else snprintf(buffer, sizeof(buffer), "idle");
+	setLine(LINE_FRAMES, buffer);
+	if(m_inputs) snprintf(buffer, sizeof(buffer), "input to swap %.1f ms   max %.1f ms", m_latencyTotal / m_inputs * 1000, m_latencyMax * 1000);
+	else snprintf(buffer, sizeof(buffer), "input to swap -");
+	setLine(LINE_LATENCY, buffer);
+
+	m_age = 0;
+	m_frames = m_inputs = 0;
+	m_frameTotal = m_frameMax = 0;
+	m_latencyTotal = m_latencyMax = 0;
+	return true;
+}
+
+void Overlay::getBoxSize(int& width, int& height) const {
+	width = height = 0;
+	for(int i=0; i<MAX_LINES; ++i) {
+		if(m_lines[i].width > width) width = m_lines[i].width;
+		height += m_lines[i].height;
+	}
+}
+
+bool Overlay::isShrinking() const {
+	int width, height;
+	getBoxSize(width, height);
+	return width < m_boxWidth || height < m_boxHeight;
+}
+
+void Overlay::render(int width, int height) const {
+	if(!m_visible) return;
+	if(m_damage > 0) --m_damage;
+
+	// Window pixels, with y down from the top
+	glViewport(0, 0, width, height);
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glOrtho(0, width, height, 0, -1, 1);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+	glDisable(GL_DEPTH_TEST);
+	glEnableClientState(GL_VERTEX_ARRAY);
+
+	// An opaque backing covers the old text, so tiles drawn in part never show through
+	int boxWidth, boxHeight;
+	getBoxSize(boxWidth, boxHeight);
+	m_boxWidth = boxWidth;
+	m_boxHeight = boxHeight;
+	float box[] = { 0,0, 0,(float)boxHeight+8, (float)boxWidth+8,0, (float)boxWidth+8,(float)boxHeight+8 };
+	glColor4f(0, 0, 0, 1);
+	glVertexPointer(2, GL_FLOAT, 0, box);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+	glEnable(GL_TEXTURE_2D);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glColor4f(1,1,1,1);
+	float y = 4;
+	for(int i=0; i<MAX_LINES; ++i) {
+		const Line& l = m_lines[i];
+		if(!l.width) continue;
+		float quad[] = { 4,y, 4,y+l.height, 4.0f+l.width,y, 4.0f+l.width,y+l.height };
+		float tex[] = { 0,0, 0,1, 1,0, 1,1 };
+		glBindTexture(GL_TEXTURE_2D, l.texture);
+		glVertexPointer(2, GL_FLOAT, 0, quad);
+		glTexCoordPointer(2, GL_FLOAT, 0, tex);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		y += l.height;
+	}
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glDisable(GL_TEXTURE_2D);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glEnable(GL_DEPTH_TEST);
+}
+
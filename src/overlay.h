@@ -0,0 +1,57 @@
+#ifndef _OVERLAY_
+#define _OVERLAY_
+
+#include <string>
+
+/** Debug text drawn over the top left corner of the window.
+ * The first lines show the frame rate and the time from input to the frame showing it */
+class Overlay {
+	public:
+	enum { LINE_FRAMES, LINE_LATENCY, LINE_USER, MAX_LINES = 16 };
+
+	Overlay();
+
+	void setFont(const char* font, int size=14);
+	void setVisible(bool v);
+	bool isVisible() const			{ return m_visible; }
+
+	/** Record a presented frame, with the seconds since the one before */
+	void frame(float interval);
+	/** Record the seconds from an input event to the swap of the frame it changed */
+	void latency(float seconds);
+	/** Set the text of a line from LINE_USER on. Lines before it are kept up to date by update() */
+	void setLine(int line, const char* text);
+
+	/** Rebuild the statistics lines every half second. Returns true when they were rebuilt */
+	bool update(float time);
+	/** True if the text changed since it was last drawn into every back buffer */
+	bool needsRedraw() const		{ return m_visible && m_damage > 0; }
+	/** True if the text needs less room than the backing last drawn. The backing only
+	 * covers the current text, so what is under the rest must be drawn again */
+	bool isShrinking() const;
+	void render(int width, int height) const;
+
+	protected:
+	struct Line {
+		std::string text;
+		unsigned    texture;
+		int         width, height;
+	};
+	void getBoxSize(int& width, int& height) const;
+
+	Line m_lines[MAX_LINES];
+	bool m_visible;
+	mutable int m_damage;
+	mutable int m_boxWidth, m_boxHeight;	// Backing last drawn
+
+	float m_age;			// Seconds since the statistics lines were built
+	int   m_frames;
+	float m_frameTotal;
+	float m_frameMax;
+	int   m_inputs;
+	float m_latencyTotal;
+	float m_latencyMax;
+};
+
+#endif
+
@@ -0,0 +1,110 @@
+#include "profile.h"
+#include "thread.h"
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+
+/** Spans each thread can hold between collections */
+static const unsigned ringSize = 4096;
+/** Spans per zone the percentiles are taken from */
+static const int windowSize = 1024;
+
+/** Spans recorded by one thread. Only the owner writes, only the collector reads.
+ * Each slot packs the zone into the top 8 bits and the duration in nanoseconds below */
+struct ProfileRing {
+	std::atomic<unsigned long long> slots[ringSize];
+	std::atomic<unsigned> head;
+	unsigned tail;			// Owned by the collector
+	ProfileRing() : head(0), tail(0) {
+		for(unsigned i=0; i<ringSize; ++i) slots[i].store(0, std::memory_order_relaxed);
+	}
+};
+
+/** Recent span durations of one zone */
+struct ProfileWindow {
+	float value[windowSize];
+	int   count;
+	int   next;
+};
+
+std::atomic<bool> Profiler::s_enabled(false);
+static thread_local ProfileRing* threadRing = 0;
+// Rings are kept after their thread exits, as the workers live for the whole run
+static base::Mutex ringLock;
+static std::vector<ProfileRing*> rings;
+static ProfileWindow windows[PROFILE_ZONES];
+
+void Profiler::setEnabled(bool e) {
+	s_enabled.store(e, std::memory_order_relaxed);
+}
+
+unsigned long long Profiler::now() {
+	return Trace::now();
+}
+
+void Profiler::record(ProfileZone zone, unsigned long long start, unsigned long long end) {
+	if(Trace::isEnabled()) Trace::span(getName(zone), start, end);
+	if(!isEnabled()) return;
+	ProfileRing* ring = threadRing;
+	if(!ring) {
+		ring = threadRing = new ProfileRing();
+		base::MutexLock lock(ringLock);
+		rings.push_back(ring);
+	}
+	unsigned long long duration = end > start? end - start: 0;
+	if(duration >> 56) duration = (1ull << 56) - 1;
+	unsigned h = ring->head.load(std::memory_order_relaxed);
+	ring->slots[h % ringSize].store((unsigned long long)zone << 56 | duration, std::memory_order_relaxed);
+	ring->head.store(h + 1, std::memory_order_release);
+}
+
+void Profiler::collect() {
+	base::MutexLock lock(ringLock);
+	for(size_t r=0; r<rings.size(); ++r) {
+		ProfileRing* ring = rings[r];
+		unsigned head = ring->head.load(std::memory_order_acquire);
+		if(head - ring->tail > ringSize) ring->tail = head - ringSize;
+		for(; ring->tail != head; ++ring->tail) {
+			unsigned long long v = ring->slots[ring->tail % ringSize].load(std::memory_order_relaxed);
+			int zone = v >> 56;
+			if(zone >= PROFILE_ZONES) continue;
+			ProfileWindow& w = windows[zone];
+			w.value[w.next] = (v & ((1ull << 56) - 1)) * 1e-9f;
+			w.next = (w.next + 1) % windowSize;
+			if(w.count < windowSize) ++w.count;
+		}
+	}
+}
+
+Profiler::Stats Profiler::getStats(ProfileZone zone) {
+	Stats stats = { 0, 0, 0, 0 };
+	const ProfileWindow& w = windows[zone];
+	if(w.count == 0) return stats;
+	std::vector<float> sorted(w.value, w.value + w.count);
+	std::sort(sorted.begin(), sorted.end());
+	stats.count = w.count;
+	stats.p50 = sorted[ (w.count - 1) * 50 / 100 ];
+	stats.p95 = sorted[ (w.count - 1) * 95 / 100 ];
+	stats.p99 = sorted[ (w.count - 1) * 99 / 100 ];
+	return stats;
+}
+
+const char* Profiler::getName(ProfileZone zone) {
+	static const char* names[] = { "events", "update", "pose", "render", "swap", "text", "load" };
+	return zone < PROFILE_ZONES? names[zone]: "";
+}
+
+size_t Profiler::getMemoryUsage() {
+	#ifdef LINUX
+	FILE* fp = fopen("/proc/self/statm", "r");
+	if(!fp) return 0;
+	unsigned long size = 0, resident = 0;
+	int r = fscanf(fp, "%lu %lu", &size, &resident);
+	fclose(fp);
+	if(r != 2) return 0;
+	return resident * sysconf(_SC_PAGESIZE);
+	#else
+	return 0;
+	#endif
+}
+
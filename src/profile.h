@@ -0,0 +1,55 @@
+#ifndef _PROFILE_
+#define _PROFILE_
+
+#include <atomic>
+#include <cstddef>
+#include "trace.h"
+
+/** Subsystems timed by the profiler */
+enum ProfileZone { PROFILE_EVENTS, PROFILE_UPDATE, PROFILE_POSE, PROFILE_RENDER, PROFILE_SWAP, PROFILE_TEXT, PROFILE_LOAD, PROFILE_ZONES };
+
+/** Time spent in each subsystem. Every thread records into its own ring buffer without
+ * locking, and one thread collects the rings into rolling windows for percentiles.
+ * Spans are also written to the Trace while it is recording */
+class Profiler {
+	public:
+	struct Stats {
+		int   count;			// Spans in the window
+		float p50, p95, p99;	// Seconds
+	};
+
+	static void setEnabled(bool);
+	static bool isEnabled()		{ return s_enabled.load(std::memory_order_relaxed); }
+	/** True if spans are wanted by the profiler or the trace */
+	static bool isActive()		{ return isEnabled() || Trace::isEnabled(); }
+	/** Timer clock in nanoseconds, the same as the trace */
+	static unsigned long long now();
+	/** Record a span on the calling thread */
+	static void record(ProfileZone zone, unsigned long long start, unsigned long long end);
+
+	/** Move recorded spans into the rolling windows. Call from one thread only.
+	 * Rings hold a few thousand spans, so a thread that records more between calls loses the oldest */
+	static void collect();
+	/** Percentiles of the most recent spans of a zone */
+	static Stats getStats(ProfileZone);
+	static const char* getName(ProfileZone);
+	/** Resident memory of the process in bytes, or 0 if unknown */
+	static size_t getMemoryUsage();
+
+	private:
+	static std::atomic<bool> s_enabled;
+};
+
+/** Times the enclosing block while the profiler or trace is on */
+class ProfileScope {
+	public:
+	ProfileScope(ProfileZone zone) : m_zone(zone), m_start(Profiler::isActive()? Profiler::now(): 0) {}
+	~ProfileScope() { if(m_start) Profiler::record(m_zone, m_start, Profiler::now()); }
+
+	private:
+	ProfileZone        m_zone;
+	unsigned long long m_start;
+};
+
+#endif
+
@@ -0,0 +1,32 @@
+#include "scheduler.h"
+#include "view.h"
+
+/** Seconds between poses at each detail level, before any slowdown */
+static const float baseInterval[] = { 1.0f / 60, 1.0f / 30, 1.0f / 15 };
+/** Slowest background views may go, in seconds between poses */
+static const float maxInterval = 0.25f;
+
+UpdateScheduler::UpdateScheduler(float target) : m_target(target), m_average(target), m_slowdown(1) {
+}
+
+void UpdateScheduler::schedule(const std::vector<View*>& views, const View* active, const View* hovered) {
+	for(size_t i=0; i<views.size(); ++i) {
+		View* view = views[i];
+		if(view == active || view == hovered) {
+			view->setPoseInterval(0);
+			continue;
+		}
+		float interval = baseInterval[ view->getDetail() ] * m_slowdown;
+		view->setPoseInterval(interval < maxInterval? interval: maxInterval);
+	}
+}
+
+void UpdateScheduler::measured(float seconds) {
+	m_average += (seconds - m_average) * 0.1f;
+	// Back off quickly when over budget and recover slowly, so rates do not oscillate
+	if(m_average > m_target) m_slowdown *= 1.1f;
+	else if(m_average < m_target * 0.75f) m_slowdown /= 1.02f;
+	if(m_slowdown < 1) m_slowdown = 1;
+	if(m_slowdown > maxInterval * 60) m_slowdown = maxInterval * 60;
+}
+
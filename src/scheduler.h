@@ -0,0 +1,32 @@
+#ifndef _SCHEDULER_
+#define _SCHEDULER_
+
+#include <vector>
+
+class View;
+
+/** Decides how often each visible view evaluates its pose. Views get a rate from their
+ * detail level, the active and hovered views always run every frame, and the rest slow
+ * down together while frames take longer than the target. */
+class UpdateScheduler {
+	public:
+	/** @param target Frame time to aim for, in seconds */
+	UpdateScheduler(float target=1.0f/60);
+
+	/** Set the pose interval of every view for this frame */
+	void schedule(const std::vector<View*>& views, const View* active, const View* hovered);
+	/** Report the time spent updating and drawing this frame, in seconds */
+	void measured(float seconds);
+
+	/** How much background views are slowed beyond their base rate */
+	float getSlowdown() const { return m_slowdown; }
+	float getAverage() const  { return m_average; }
+
+	protected:
+	float m_target;
+	float m_average;	// Smoothed frame time
+	float m_slowdown;
+};
+
+#endif
+
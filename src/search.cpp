@@ -0,0 +1,166 @@
+#include "search.h"
+#include "catalog.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+
+static inline char lower(char c) {
+	return c >= 'A' && c <= 'Z'? c + 32: c;
+}
+static inline unsigned trigram(const char* s) {
+	return (unsigned char)lower(s[0]) | (unsigned char)lower(s[1]) << 8 | (unsigned char)lower(s[2]) << 16;
+}
+/** Case insensitive strstr. The term is already lower case */
+static bool contains(const char* s, const char* term, size_t length) {
+	for(; *s; ++s) {
+		size_t i = 0;
+		while(i < length && s[i] && lower(s[i]) == term[i]) ++i;
+		if(i == length) return true;
+	}
+	return false;
+}
+
+// ------------------------------------------------- //
+
+CatalogSearch::CatalogSearch() : m_indexed(0) {
+}
+
+void CatalogSearch::update(const Catalog& catalog) {
+	std::vector<unsigned> keys;
+	for(; m_indexed < catalog.size(); ++m_indexed) {
+		const char* name = catalog.getName(m_indexed);
+		keys.clear();
+		for(const char* c=name; c[0] && c[1] && c[2]; ++c) keys.push_back( trigram(c) );
+		std::sort(keys.begin(), keys.end());
+		keys.erase( std::unique(keys.begin(), keys.end()), keys.end() );
+		for(size_t i=0; i<keys.size(); ++i) m_trigrams[ keys[i] ].push_back(m_indexed);
+	}
+}
+
+bool CatalogSearch::parseTest(const char* term, Field& field, Compare& compare, float& value) const {
+	static const char* names[] = { "frames", "joints", "duration", "rig" };
+	for(int f=0; f<4; ++f) {
+		size_t n = strlen(names[f]);
+		if(strncmp(term, names[f], n) != 0) continue;
+		const char* c = term + n;
+		if(c[0] == '<' && c[1] == '=')      compare = LESS_EQUAL, c += 2;
+		else if(c[0] == '>' && c[1] == '=') compare = GREATER_EQUAL, c += 2;
+		else if(c[0] == '<')                compare = LESS, c += 1;
+		else if(c[0] == '>')                compare = GREATER, c += 1;
+		else if(c[0] == '=')                compare = EQUAL, c += 1;
+		else return false;
+		char* end;
+		value = strtod(c, &end);
+		if(end == c || *end) return false;
+		field = (Field)f;
+		return true;
+	}
+	return false;
+}
+
+void CatalogSearch::findNames(const Catalog& catalog, const char* term, std::vector<char>& hit) const {
+	size_t length = strlen(term);
+	if(length < 3) {
+		// Too short to index
+		for(int i=0; i<catalog.size(); ++i) {
+			if(contains(catalog.getName(i), term, length)) hit[i] = 1;
+		}
+		return;
+	}
+
+	// Files containing every trigram of the term, starting from the rarest
+	std::vector<const std::vector<unsigned>*> lists;
+	for(size_t i=0; i+2<length; ++i) {
+		std::unordered_map< unsigned, std::vector<unsigned> >::const_iterator it = m_trigrams.find( trigram(term+i) );
+		if(it == m_trigrams.end()) return;
+		lists.push_back(&it->second);
+	}
+	std::sort(lists.begin(), lists.end(), [](const std::vector<unsigned>* a, const std::vector<unsigned>* b) { return a->size() < b->size(); });
+	std::vector<unsigned> candidates = *lists[0];
+	for(size_t k=1; k<lists.size() && !candidates.empty(); ++k) {
+		const std::vector<unsigned>& list = *lists[k];
+		size_t out = 0;
+		for(size_t i=0; i<candidates.size(); ++i) {
+			if(std::binary_search(list.begin(), list.end(), candidates[i])) candidates[out++] = candidates[i];
+		}
+		candidates.resize(out);
+	}
+
+	// Trigrams can match out of order, so check the real text
+	for(size_t i=0; i<candidates.size(); ++i) {
+		if(contains(catalog.getName(candidates[i]), term, length)) hit[ candidates[i] ] = 1;
+	}
+}
+
+bool CatalogSearch::query(const Catalog& catalog, const char* text, std::vector<int>& out) {
+	update(catalog);
+	int count = catalog.size();
+	m_match.assign(count, 1);
+	bool usesInfo = false;
+
+	const char* c = text;
+	std::string term;
+	while(*c) {
+		while(*c == ' ') ++c;
+		if(!*c) break;
+		term.clear();
+		while(*c && *c != ' ') term += lower(*c++);
+
+		Field field;
+		Compare compare;
+		float value;
+		if(parseTest(term.c_str(), field, compare, value)) {
+			usesInfo = true;
+			for(int i=0; i<count; ++i) {
+				if(!m_match[i]) continue;
+				int frames, joints, rig;
+				float frameTime;
+				if(!catalog.getInfo(i, frames, joints, frameTime, rig)) { m_match[i] = 0; continue; }
+				float v = field == FRAMES? frames: field == JOINTS? joints: field == RIG? rig: frames * frameTime;
+				bool pass = false;
+				switch(compare) {
+				case LESS:          pass = v < value; break;
+				case LESS_EQUAL:    pass = v <= value; break;
+				case EQUAL:         pass = field == DURATION? fabs(v - value) < 0.05f: v == value; break;
+				case GREATER_EQUAL: pass = v >= value; break;
+				case GREATER:       pass = v > value; break;
+				}
+				m_match[i] = pass;
+			}
+			continue;
+		}
+
+		// Text term
+		m_hit.assign(count, 0);
+		findNames(catalog, term.c_str(), m_hit);
+
+		// Directories and archives are few, so test each once then apply to their files
+		std::vector<char> directories(catalog.getDirectoryCount(), 0);
+		std::vector<char> archives(catalog.getArchiveCount(), 0);
+		bool any = false;
+		for(size_t d=0; d<directories.size(); ++d) {
+			directories[d] = contains(catalog.getDirectoryPath(d), term.c_str(), term.size());
+			any |= directories[d];
+		}
+		for(size_t a=0; a<archives.size(); ++a) {
+			archives[a] = contains(catalog.getArchivePath(a), term.c_str(), term.size());
+			any |= archives[a];
+		}
+		if(any) {
+			for(int i=0; i<count; ++i) {
+				const Catalog::Entry& e = catalog[i];
+				if(directories[e.directory] || (e.archive >= 0 && archives[e.archive])) m_hit[i] = 1;
+			}
+		}
+		for(int i=0; i<count; ++i) m_match[i] &= m_hit[i];
+	}
+
+	out.clear();
+	for(int i=0; i<count; ++i) {
+		if(m_match[i]) out.push_back(i);
+	}
+	return usesInfo;
+}
+
@@ -0,0 +1,39 @@
+#ifndef _SEARCH_
+#define _SEARCH_
+
+#include <vector>
+#include <unordered_map>
+
+class Catalog;
+
+/** Filters the catalog by a typed query.
+ * Terms are separated by spaces and must all match. A term is either text, found
+ * case insensitively in the file name, directory or archive path, or a test on
+ * clip info such as frames>100, joints=59, duration<=2.5 or rig=2.
+ * File names are indexed by trigram so a query does not scan every name. */
+class CatalogSearch {
+	public:
+	CatalogSearch();
+
+	/** Index any files added to the catalog since the last call */
+	void update(const Catalog&);
+
+	/** Fill out with the indices of matching files, in catalog order.
+	 * Files whose info is not known yet fail info tests.
+	 * @return true if the query tests clip info */
+	bool query(const Catalog&, const char* text, std::vector<int>& out);
+
+	protected:
+	enum Field { FRAMES, JOINTS, DURATION, RIG };
+	enum Compare { LESS, LESS_EQUAL, EQUAL, GREATER_EQUAL, GREATER };
+	bool parseTest(const char* term, Field& field, Compare& compare, float& value) const;
+	void findNames(const Catalog&, const char* term, std::vector<char>& hit) const;
+
+	std::unordered_map< unsigned, std::vector<unsigned> > m_trigrams;	// Files whose names contain each trigram
+	int m_indexed;
+	std::vector<char> m_match;	// Scratch space for query()
+	std::vector<char> m_hit;
+};
+
+#endif
+
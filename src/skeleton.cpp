@@ -0,0 +1,103 @@
+#include "skeleton.h"
+#include "thread.h"
+#include <unordered_map>
+#include <cstring>
+
+/** Every live skeleton, and the rig number of every hierarchy seen */
+static base::Mutex registryLock;
+static std::unordered_multimap<unsigned long long, Skeleton*> registry;
+static std::unordered_map<unsigned long long, int> rigs;
+
+static unsigned long long hashHierarchy(int joints, const char* const* names, const int* parents, const unsigned* channels) {
+	// FNV-1a
+	unsigned long long h = 14695981039346656037ull;
+	for(int i=0; i<joints; ++i) {
+		for(const char* c=names[i]; c && *c; ++c) h = (h ^ (unsigned char)*c) * 1099511628211ull;
+		h = (h ^ 0xff) * 1099511628211ull;
+		h = (h ^ (unsigned)parents[i]) * 1099511628211ull;
+		h = (h ^ channels[i]) * 1099511628211ull;
+	}
+	return h;
+}
+
+Skeleton::Skeleton() : m_joints(0), m_names(0), m_parents(0), m_channels(0), m_hash(0), m_rig(-1), m_references(0) {
+}
+
+Skeleton::~Skeleton() {
+	if(m_joints) delete [] m_names[0];
+	delete [] m_names;
+	delete [] m_parents;
+	delete [] m_channels;
+}
+
+bool Skeleton::equals(int joints, const char* const* names, const int* parents, const unsigned* channels) const {
+	if(joints != m_joints) return false;
+	for(int i=0; i<joints; ++i) {
+		if(parents[i] != m_parents[i] || channels[i] != m_channels[i]) return false;
+		if(strcmp(names[i]? names[i]: "", m_names[i]) != 0) return false;
+	}
+	return true;
+}
+
+const Skeleton* Skeleton::intern(int joints, const char* const* names, const int* parents, const unsigned* channels) {
+	unsigned long long hash = hashHierarchy(joints, names, parents, channels);
+	base::MutexLock lock(registryLock);
+	typedef std::unordered_multimap<unsigned long long, Skeleton*>::iterator Iterator;
+	std::pair<Iterator, Iterator> range = registry.equal_range(hash);
+	for(Iterator it=range.first; it!=range.second; ++it) {
+		if(it->second->equals(joints, names, parents, channels)) {
+			it->second->addReference();
+			return it->second;
+		}
+	}
+
+	Skeleton* s = new Skeleton();
+	s->m_joints = joints;
+	s->m_hash = hash;
+	s->m_parents = new int[joints];
+	s->m_channels = new unsigned[joints];
+	memcpy(s->m_parents, parents, joints * sizeof(int));
+	memcpy(s->m_channels, channels, joints * sizeof(unsigned));
+	size_t size = 0;
+	for(int i=0; i<joints; ++i) size += (names[i]? strlen(names[i]): 0) + 1;
+	char* pool = new char[size];
+	s->m_names = new char*[joints];
+	for(int i=0; i<joints; ++i) {
+		size_t length = names[i]? strlen(names[i]): 0;
+		if(length) memcpy(pool, names[i], length);
+		pool[length] = 0;
+		s->m_names[i] = pool;
+		pool += length + 1;
+	}
+	std::unordered_map<unsigned long long, int>::iterator rig = rigs.find(hash);
+	if(rig == rigs.end()) rig = rigs.insert( std::make_pair(hash, (int)rigs.size()) ).first;
+	s->m_rig = rig->second;
+	s->m_references.store(1, std::memory_order_relaxed);
+	registry.insert( std::make_pair(hash, s) );
+	return s;
+}
+
+int Skeleton::getRigCount() {
+	base::MutexLock lock(registryLock);
+	return rigs.size();
+}
+
+void Skeleton::addReference() const {
+	m_references.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Skeleton::release() const {
+	// The lock stops intern() handing out a skeleton that is being deleted
+	base::MutexLock lock(registryLock);
+	if(m_references.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+	typedef std::unordered_multimap<unsigned long long, Skeleton*>::iterator Iterator;
+	std::pair<Iterator, Iterator> range = registry.equal_range(m_hash);
+	for(Iterator it=range.first; it!=range.second; ++it) {
+		if(it->second == this) {
+			registry.erase(it);
+			break;
+		}
+	}
+	delete this;
+}
+
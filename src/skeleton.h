@@ -0,0 +1,44 @@
+#ifndef _SKELETON_
+#define _SKELETON_
+
+#include <atomic>
+
+/** Joint names, parents and channels of a rig. Skeletons are interned, so every clip
+ * using a rig shares one immutable object. Joint offsets stay with each clip. */
+class Skeleton {
+	public:
+	/** Find or create the shared skeleton for a hierarchy, and add a reference to it.
+	 * Safe to call from any thread */
+	static const Skeleton* intern(int joints, const char* const* names, const int* parents, const unsigned* channels);
+	/** Number of different rigs seen, including any no longer used */
+	static int getRigCount();
+
+	void addReference() const;
+	/** Drop a reference. The last one deletes the skeleton */
+	void release() const;
+
+	int         getJointCount() const      { return m_joints; }
+	const char* getName(int joint) const   { return m_names[joint]; }
+	int         getParent(int joint) const { return m_parents[joint]; }
+	unsigned    getChannels(int joint) const { return m_channels[joint]; }
+	/** Hash of the names, parents and channels */
+	unsigned long long getHash() const     { return m_hash; }
+	/** Small number identifying the rig. It stays the same if the skeleton is freed and made again */
+	int         getRig() const             { return m_rig; }
+
+	private:
+	Skeleton();
+	~Skeleton();
+	bool equals(int joints, const char* const* names, const int* parents, const unsigned* channels) const;
+
+	int     m_joints;
+	char**  m_names;		// Point into one allocation
+	int*    m_parents;
+	unsigned* m_channels;
+	unsigned long long m_hash;
+	int     m_rig;
+	mutable std::atomic<int> m_references;
+};
+
+#endif
+
@@ -0,0 +1,238 @@
+#include "task.h"
+#include <cstdio>
+
+#ifdef LINUX
+#include <pthread.h>
+#endif
+
+using namespace base;
+
+static thread_local Executor* s_executor = 0;
+static thread_local int       s_worker = -1;
+
+Executor::Executor(int threads, const char* name) : m_pending(0), m_quit(false) {
+	if(threads <= 0) threads = std::thread::hardware_concurrency() - 1;
+	if(threads < 0) threads = 0;
+	for(int i=0; i<threads; ++i) m_workers.push_back( new Worker );
+	for(int i=0; i<threads; ++i) {
+		char buffer[16];
+		snprintf(buffer, sizeof(buffer), "%s-%d", name, i);
+		m_workers[i]->thread = std::thread(&Executor::workerFunc, this, i, std::string(buffer));
+	}
+}
+
+Executor::~Executor() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_wake.notify_all();
+	for(size_t i=0; i<m_workers.size(); ++i) {
+		m_workers[i]->thread.join();
+		delete m_workers[i];
+	}
+}
+
+int Executor::currentWorker() {
+	return s_worker;
+}
+
+void Executor::push(Task&& task, bool background) {
+	if(m_workers.empty()) {
+		task();
+		return;
+	}
+	if(background) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_background.push_back(std::move(task));
+		m_pending.fetch_add(1, std::memory_order_release);
+	}
+	else if(s_executor == this) {
+		Worker* worker = m_workers[s_worker];
+		std::lock_guard<std::mutex> lock(worker->mutex);
+		worker->tasks.push_back(std::move(task));
+		m_pending.fetch_add(1, std::memory_order_release);
+	}
+	else {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queue.push_back(std::move(task));
+		m_pending.fetch_add(1, std::memory_order_release);
+	}
+	// Taking the lock means a worker about to sleep sees the new task first
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_wake.notify_one();
+}
+
+bool Executor::pop(int index, Task& task) {
+	if(m_pending.load(std::memory_order_acquire) == 0) return false;
+
+	// Someone outside the pool is waiting on these
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(!m_urgent.empty()) {
+			task = std::move(m_urgent.front());
+			m_urgent.pop_front();
+			m_pending.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+
+	// Then own work, newest first while it is still in cache
+	Worker* self = m_workers[index];
+	{
+		std::lock_guard<std::mutex> lock(self->mutex);
+		if(!self->tasks.empty()) {
+			task = std::move(self->tasks.back());
+			self->tasks.pop_back();
+			m_pending.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+
+	// Then outside requests in the order they arrived
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(!m_queue.empty()) {
+			task = std::move(m_queue.front());
+			m_queue.pop_front();
+			m_pending.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+
+	// Steal the oldest task from another worker
+	for(size_t k=1; k<m_workers.size(); ++k) {
+		Worker* victim = m_workers[ (index + k) % m_workers.size() ];
+		std::lock_guard<std::mutex> lock(victim->mutex);
+		if(!victim->tasks.empty()) {
+			task = std::move(victim->tasks.front());
+			victim->tasks.pop_front();
+			m_pending.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+
+	// Background work last
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(!m_background.empty()) {
+		task = std::move(m_background.front());
+		m_background.pop_front();
+		m_pending.fetch_sub(1, std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+void Executor::workerFunc(int index, std::string name) {
+	s_executor = this;
+	s_worker = index;
+	#ifdef LINUX
+	pthread_setname_np(pthread_self(), name.c_str());
+	#endif
+
+	Task task;
+	while(true) {
+		if(pop(index, task)) {
+			task();
+			task = nullptr;
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if(m_pending.load(std::memory_order_acquire) > 0) continue;
+		if(m_quit) return;
+		m_wake.wait(lock);
+	}
+}
+
+// ------------------------------------------------- //
+
+namespace {
+	/** Progress of one parallelFor. Shared, as helper tasks may start after it returns */
+	struct ForState {
+		std::atomic<int> next;
+		std::atomic<int> done;
+		int count;
+		std::mutex mutex;
+		std::condition_variable finished;
+	};
+
+	/** Takes indices of a parallelFor until none are left */
+	struct ForHelper {
+		std::shared_ptr<ForState> state;
+		const void* job;
+		void (*run)(const void* job, int index);
+		void operator()() const {
+			int completed = 0;
+			for(int i = state->next.fetch_add(1); i < state->count; i = state->next.fetch_add(1)) {
+				run(job, i);
+				++completed;
+			}
+			if(completed && state->done.fetch_add(completed, std::memory_order_acq_rel) + completed == state->count) {
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->finished.notify_one();
+			}
+		}
+	};
+
+	/** Remove helpers of a finished parallelFor from a queue. Returns how many were removed */
+	int retract(std::deque< std::function<void()> >& queue, const ForState* state) {
+		int removed = 0;
+		for(size_t i=0; i<queue.size(); ) {
+			const ForHelper* helper = queue[i].target<ForHelper>();
+			if(helper && helper->state.get() == state) {
+				queue.erase(queue.begin() + i);
+				++removed;
+			}
+			else ++i;
+		}
+		return removed;
+	}
+}
+
+void Executor::execute(const Job* job, int count) {
+	std::shared_ptr<ForState> state = std::make_shared<ForState>();
+	state->next.store(0, std::memory_order_relaxed);
+	state->done.store(0, std::memory_order_relaxed);
+	state->count = count;
+
+	// The job lives on the caller's stack. Only indices below count touch it,
+	// and the caller waits for all of those, so late helpers just find nothing to do
+	ForHelper work;
+	work.state = state;
+	work.job = job;
+	work.run = [](const void* job, int index) { static_cast<const Job*>(job)->run(index); };
+
+	// A worker keeps its helpers on its own deque, so a load group does not jump the frame
+	int helpers = count - 1 < (int)m_workers.size()? count - 1: m_workers.size();
+	if(s_executor == this) {
+		Worker* worker = m_workers[s_worker];
+		std::lock_guard<std::mutex> lock(worker->mutex);
+		for(int i=0; i<helpers; ++i) worker->tasks.push_back( Task(work) );
+		m_pending.fetch_add(helpers, std::memory_order_release);
+	}
+	else {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for(int i=0; i<helpers; ++i) m_urgent.push_back( Task(work) );
+		m_pending.fetch_add(helpers, std::memory_order_release);
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(helpers > 1) m_wake.notify_all();
+		else m_wake.notify_one();
+	}
+	work();
+
+	// Every index is taken, so helpers still queued have nothing to do
+	if(s_executor == this) {
+		Worker* worker = m_workers[s_worker];
+		std::lock_guard<std::mutex> lock(worker->mutex);
+		m_pending.fetch_sub(retract(worker->tasks, state.get()), std::memory_order_relaxed);
+	}
+	else {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pending.fetch_sub(retract(m_urgent, state.get()), std::memory_order_relaxed);
+	}
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	while(state->done.load(std::memory_order_acquire) < count) state->finished.wait(lock);
+}
@@ -0,0 +1,120 @@
+#ifndef _BASE_TASK_
+#define _BASE_TASK_
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <future>
+#include <functional>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <string>
+
+namespace base {
+	/** Shared flag telling a task its result is no longer wanted.
+	 * Copies refer to the same flag. Tasks poll cancelled() at convenient points. */
+	class CancelToken {
+		public:
+		CancelToken() : m_flag(std::make_shared< std::atomic<bool> >(false)) {}
+		void cancel()          { m_flag->store(true, std::memory_order_relaxed); }
+		bool cancelled() const { return m_flag->load(std::memory_order_relaxed); }
+		private:
+		std::shared_ptr< std::atomic<bool> > m_flag;
+	};
+
+	/** Fixed set of named worker threads running submitted tasks.
+	 * Tasks submitted from outside go through a shared FIFO queue. Tasks submitted
+	 * by a worker go on that worker's own deque, which it runs newest first while
+	 * idle workers steal the oldest. Helpers of a parallelFor called from outside the
+	 * pool, such as the frame, go ahead of everything else. */
+	class Executor {
+		public:
+		/** @param threads Number of workers. 0 uses one per core, minus the calling thread
+		 *  @param name    Thread name prefix shown by debuggers and top */
+		Executor(int threads=0, const char* name="worker");
+		/** Waits for queued tasks to finish, then joins the workers */
+		~Executor();
+
+		/** Number of threads taking part in parallelFor, including the caller */
+		int size() const { return m_workers.size() + 1; }
+
+		/** Queue func to run on a worker. The future holds its result.
+		 * A worker must not wait on a task queued after its own, as nothing may be left to run it */
+		template<typename F>
+		auto submit(F&& func) -> std::future<decltype(func())> {
+			typedef decltype(func()) R;
+			std::shared_ptr< std::packaged_task<R()> > task = std::make_shared< std::packaged_task<R()> >(std::forward<F>(func));
+			std::future<R> result = task->get_future();
+			push( [task]() { (*task)(); } );
+			return result;
+		}
+
+		/** Queue func to run once nothing else is waiting */
+		template<typename F>
+		auto submitBackground(F&& func) -> std::future<decltype(func())> {
+			typedef decltype(func()) R;
+			std::shared_ptr< std::packaged_task<R()> > task = std::make_shared< std::packaged_task<R()> >(std::forward<F>(func));
+			std::future<R> result = task->get_future();
+			push( [task]() { (*task)(); }, true );
+			return result;
+		}
+
+		/** Call func(i) for every i in [0,count). The calling thread takes part
+		 * and the call returns once every index has been processed. Helpers that
+		 * have not started by then are taken off the queues. */
+		template<typename F>
+		void parallelFor(int count, const F& func) {
+			if(count <= 0) return;
+			if(m_workers.empty() || count == 1) {
+				for(int i=0; i<count; ++i) func(i);
+				return;
+			}
+			JobF<F> job(func);
+			execute(&job, count);
+		}
+
+		/** Index of the calling worker in its executor, or -1 for other threads */
+		static int currentWorker();
+		/** Tasks queued and not yet started */
+		int getPending() const { return m_pending.load(std::memory_order_relaxed); }
+
+		private:
+		typedef std::function<void()> Task;
+
+		struct Job {
+			virtual void run(int index) const = 0;
+			virtual ~Job() {}
+		};
+		template<typename F> struct JobF : public Job {
+			const F& func;
+			JobF(const F& f) : func(f) {}
+			void run(int index) const { func(index); }
+		};
+
+		struct alignas(64) Worker {
+			std::thread      thread;
+			std::mutex       mutex;
+			std::deque<Task> tasks;
+		};
+
+		void push(Task&& task, bool background=false);
+		bool pop(int worker, Task& task);
+		void execute(const Job* job, int count);
+		void workerFunc(int index, std::string name);
+
+		private:
+		std::vector<Worker*>     m_workers;
+		std::mutex               m_mutex;		// Guards m_queue and sleeping
+		std::condition_variable  m_wake;
+		std::deque<Task>         m_urgent;		// parallelFor helpers for threads outside the pool
+		std::deque<Task>         m_queue;		// Tasks from outside the pool
+		std::deque<Task>         m_background;	// Tasks run when there is nothing else
+		std::atomic<int>         m_pending;		// Tasks queued anywhere
+		bool                     m_quit;
+	};
+};
+
+#endif
+
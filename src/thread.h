@@ -16,13 +16,15 @@
 #endif
 
 #include <cstdio>
+#include <atomic>
 
 namespace base {
 	class Thread {
 		public:
-		Thread() : m_running(false), m_priority(0), m_thread(0) {};
+		Thread() : m_running(false), m_joinable(false), m_priority(0), m_thread(0) {};
 		~Thread() { 
 			if(m_running) printf("Warning: Thread still running\n");
+			detach();
 		}
 
 		/** Begin a new thread
@@ -80,10 +82,32 @@ namespace base {
 		void terminate();
 
 		/** Is th thread running */
-		bool running() const { return m_running; }
+		bool running() const { return m_running.load(std::memory_order_acquire); }
 
 		/** Wait here until thread exits */
-		void join() const { while(m_running) sleep(10); }
+		void join() {
+			if(!m_joinable) return;
+			#ifdef WIN32
+			WaitForSingleObject(m_thread, INFINITE);
+			CloseHandle(m_thread);
+			#endif
+			#ifdef LINUX
+			pthread_join(m_thread, 0);
+			#endif
+			m_joinable = false;
+		}
+
+		/** Let the thread clean up after itself when it exits */
+		void detach() {
+			if(!m_joinable) return;
+			#ifdef WIN32
+			CloseHandle(m_thread);
+			#endif
+			#ifdef LINUX
+			pthread_detach(m_thread);
+			#endif
+			m_joinable = false;
+		}
 		
 		/** set thread priority (WIN32 only) */
 		void priority(int p) {
@@ -103,7 +127,7 @@ namespace base {
 		/** Tell current thread to sleep (milliseconds) */
 		static void sleep(int time) {
 			#ifdef LINUX
-			usleep(time);
+			usleep(time * 1000);
 			#endif
 			#ifdef WIN32
 			Sleep(time);
@@ -140,49 +164,57 @@ namespace base {
 
 		bool _beginThread(ThreadData* data) {
 			data->thread = this;
+			detach();	// Forget any previous thread
+			// Set before starting so running() is true as soon as begin() returns
+			m_running.store(true, std::memory_order_release);
+			bool created = false;
 			#ifdef WIN32
 			m_thread = (HANDLE)_beginthreadex(0, 0, _threadFunc, data, 0, &m_threadID);
-			if(m_priority) SetThreadPriority(m_thread, m_priority); //set thread priority
+			created = m_thread != 0;
+			if(created && m_priority) SetThreadPriority(m_thread, m_priority); //set thread priority
 			#endif
 			#ifdef LINUX
 			pthread_attr_init(&pattr);
 			pthread_attr_setscope(&pattr, PTHREAD_SCOPE_SYSTEM);
-			pthread_attr_setdetachstate(&pattr, PTHREAD_CREATE_DETACHED);
-			//usleep(1000);
-			pthread_create(&m_thread, &pattr, _threadFunc, data);
+			created = pthread_create(&m_thread, &pattr, _threadFunc, data) == 0;
+			pthread_attr_destroy(&pattr);
 			#endif
 			
 			//thread creation failed
-			if(m_thread==0) {
+			if(!created) {
 				printf("Failed to create thread\n");
+				m_running.store(false, std::memory_order_release);
 				delete data;
 				return false;
 			}
+			m_joinable = true;
 			return true;
 		}
 
 		#ifdef WIN32
 		static unsigned int __stdcall _threadFunc(void* data) {
 			ThreadData* d = static_cast<ThreadData*>(data);
-			d->thread->m_running = true;
+			Thread* thread = d->thread;
 			d->run();
-			d->thread->m_running = false;
 			delete d;
+			thread->m_running.store(false, std::memory_order_release);
+			return 0;
 		}
 		#else
 		static void* _threadFunc(void* data) {
 			ThreadData* d = static_cast<ThreadData*>(data);
-			d->thread->m_running = true;
+			Thread* thread = d->thread;
 			d->run();
-			d->thread->m_running = false;
-			pthread_exit(0);
 			delete d;
+			thread->m_running.store(false, std::memory_order_release);
+			return 0;
 		}
 		#endif
 
 
 		private:
-		bool m_running;			//thread status
+		std::atomic<bool> m_running;	//thread status
+		bool m_joinable;		//thread not yet joined or detached
 		int m_priority;			//thread priority
 		
 		#ifdef WIN32
@@ -212,7 +244,7 @@ namespace base {
 		~Mutex()      { pthread_mutex_destroy(&m_lock); }
 		void lock()   { pthread_mutex_lock(&m_lock); }
 		void unlock() { pthread_mutex_unlock(&m_lock); }
-		bool tryLock(){ return pthread_mutex_lock(&m_lock)==0; }
+		bool tryLock(){ return pthread_mutex_trylock(&m_lock)==0; }
 		private:
 		pthread_mutex_t m_lock;
 	};
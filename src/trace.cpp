@@ -0,0 +1,124 @@
+#include "trace.h"
+#include "thread.h"
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cstdio>
+
+/** Events one thread may record, so a forgotten trace cannot use all memory */
+static const size_t maxEvents = 1 << 20;
+
+struct TraceEvent {
+	const char*        name;
+	const char*        category;	// Async operation, or 0 for a span
+	char               phase;		// Chrome trace phase: X, b, n or e
+	unsigned long long id;
+	unsigned long long start, end;
+};
+
+struct TraceBuffer {
+	int         tid;
+	std::string name;
+	std::vector<TraceEvent> events;
+	size_t      dropped;
+};
+
+std::atomic<bool> Trace::s_enabled(false);
+static std::string tracePath;
+static unsigned long long traceStart = 0;
+static thread_local TraceBuffer* threadBuffer = 0;
+static base::Mutex bufferLock;
+static std::vector<TraceBuffer*> buffers;
+
+static TraceBuffer* getBuffer() {
+	if(threadBuffer) return threadBuffer;
+	TraceBuffer* buffer = new TraceBuffer();
+	buffer->dropped = 0;
+	char name[32] = "";
+	#ifdef LINUX
+	pthread_getname_np(pthread_self(), name, sizeof(name));
+	#endif
+	base::MutexLock lock(bufferLock);
+	buffer->tid = buffers.size() + 1;
+	buffer->name = name[0]? name: "thread";
+	// The first thread to record is the one that started the trace
+	if(buffers.empty()) buffer->name = "main";
+	buffers.push_back(buffer);
+	threadBuffer = buffer;
+	return buffer;
+}
+
+static void add(const char* name, const char* category, char phase, unsigned long long id, unsigned long long start, unsigned long long end) {
+	TraceBuffer* buffer = getBuffer();
+	if(buffer->events.size() >= maxEvents) {
+		++buffer->dropped;
+		return;
+	}
+	TraceEvent e = { name, category, phase, id, start, end };
+	buffer->events.push_back(e);
+}
+
+// ------------------------------------------------- //
+
+unsigned long long Trace::now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Trace::start(const char* path) {
+	tracePath = path;
+	traceStart = now();
+	getBuffer();
+	s_enabled.store(true, std::memory_order_relaxed);
+}
+
+void Trace::span(const char* name, unsigned long long start, unsigned long long end) {
+	if(isEnabled()) add(name, 0, 'X', 0, start, end);
+}
+
+void Trace::asyncBegin(const char* name, unsigned long long id) {
+	if(isEnabled()) add(name, name, 'b', id, now(), 0);
+}
+
+void Trace::asyncStep(const char* name, unsigned long long id, const char* step) {
+	if(isEnabled()) add(step, name, 'n', id, now(), 0);
+}
+
+void Trace::asyncEnd(const char* name, unsigned long long id) {
+	if(isEnabled()) add(name, name, 'e', id, now(), 0);
+}
+
+void Trace::stop() {
+	if(!isEnabled()) return;
+	s_enabled.store(false, std::memory_order_relaxed);
+
+	FILE* fp = fopen(tracePath.c_str(), "w");
+	if(!fp) {
+		printf("Failed to write trace %s\n", tracePath.c_str());
+		return;
+	}
+	base::MutexLock lock(bufferLock);
+	size_t count = 0, dropped = 0;
+	fprintf(fp, "{\"traceEvents\":[\n");
+	for(size_t b=0; b<buffers.size(); ++b) {
+		const TraceBuffer* buffer = buffers[b];
+		fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", b? ",\n": "", buffer->tid, buffer->name.c_str());
+		for(size_t i=0; i<buffer->events.size(); ++i) {
+			const TraceEvent& e = buffer->events[i];
+			// Timestamps are microseconds from the start of the trace
+			double ts = (double)(long long)(e.start - traceStart) / 1000;
+			if(e.phase == 'X') {
+				fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}", e.name, ts, (e.end - e.start) / 1000.0, buffer->tid);
+			}
+			else {
+				fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"id\":%llu,\"ts\":%.3f,\"pid\":1,\"tid\":%d}", e.name, e.category, e.phase, e.id, ts, buffer->tid);
+			}
+		}
+		count += buffer->events.size();
+		dropped += buffer->dropped;
+	}
+	fprintf(fp, "\n]}\n");
+	fclose(fp);
+	printf("Wrote %d trace events to %s\n", (int)count, tracePath.c_str());
+	if(dropped) printf("  %d events dropped\n", (int)dropped);
+}
+
@@ -0,0 +1,43 @@
+#ifndef _TRACE_
+#define _TRACE_
+
+#include <atomic>
+
+/** Timeline of spans written as a Chrome trace (chrome://tracing, ui.perfetto.dev).
+ * Each thread appends to its own buffer, and the file is written by stop() once the
+ * other threads are finished. Names must be string literals */
+class Trace {
+	public:
+	/** Begin recording, to be written to a file by stop() */
+	static void start(const char* path);
+	/** Write the trace. No other thread may record while this runs */
+	static void stop();
+	static bool isEnabled()		{ return s_enabled.load(std::memory_order_relaxed); }
+	/** Clock in nanoseconds */
+	static unsigned long long now();
+
+	/** A span on the calling thread */
+	static void span(const char* name, unsigned long long start, unsigned long long end);
+	/** Spans that may begin and end on different threads, such as a load from request to display.
+	 * Events with the same name and id belong together */
+	static void asyncBegin(const char* name, unsigned long long id);
+	static void asyncStep(const char* name, unsigned long long id, const char* step);
+	static void asyncEnd(const char* name, unsigned long long id);
+
+	private:
+	static std::atomic<bool> s_enabled;
+};
+
+/** Traces the enclosing block while tracing is on */
+class TraceScope {
+	public:
+	TraceScope(const char* name) : m_name(name), m_start(Trace::isEnabled()? Trace::now(): 0) {}
+	~TraceScope() { if(m_start) Trace::span(m_name, m_start, Trace::now()); }
+
+	private:
+	const char*        m_name;
+	unsigned long long m_start;
+};
+
+#endif
+
@@ -116,6 +116,34 @@ inline Quaternion slerp(const Quaternion& a, const Quaternion& b, float t) {
 	return a;
 }
 
+/** Normalised lerp. Takes the shortest path like slerp but does not keep constant
+ * angular velocity. Max angle error against slerp is under 0.0001 degrees for steps
+ * of 4 degrees between frames, 0.03 at 30 degrees and 0.9 at 90 degrees */
+inline Quaternion nlerp(const Quaternion& a, const Quaternion& b, float t) {
+	float c = a.x*b.x + a.y*b.y + a.z*b.z + a.w*b.w;
+	float u = 1.f - t;
+	float v = c<0? -t: t;
+	Quaternion r(a.x*u + b.x*v, a.y*u + b.y*v, a.z*u + b.z*v, a.w*u + b.w*v);
+	float l = r.x*r.x + r.y*r.y + r.z*r.z + r.w*r.w;
+	if(l > 0) {
+		l = 1.f / sqrt(l);
+		r.x *= l; r.y *= l; r.z *= l; r.w *= l;
+	}
+	return r;
+}
+
+/** Approximate slerp: nlerp with t corrected by a polynomial fitted to the slerp
+ * velocity curve (zeux, "Approximating slerp", 2015). Max angle error against slerp
+ * is under 0.005 degrees for steps up to 90 degrees, and 0.04 near 180 */
+inline Quaternion fastSlerp(const Quaternion& a, const Quaternion& b, float t) {
+	float d = fabs(a.x*b.x + a.y*b.y + a.z*b.z + a.w*b.w);
+	float A = 1.0904f + d * (-3.2452f + d * (3.55645f - d * 1.43519f));
+	float B = 0.848013f + d * (-1.06021f + d * 0.215638f);
+	float k = A * (t - 0.5f) * (t - 0.5f) + B;
+	float ot = t + t * (t - 0.5f) * (t - 1) * k;
+	return nlerp(a, b, ot);
+}
+
 // --------------------------------------------------------------------------------- //
 
 inline void multMatrix(const float* a, const float* b, float* out) {
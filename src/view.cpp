@@ -1,14 +1,19 @@
 #include "view.h"
+#include "profile.h"
 #include <SDL_opengl.h>
 #include <SDL_ttf.h>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 
 View::View(int x, int y, int w, int h) : m_x(x), m_y(y), m_width(w), m_height(h), 
 										 m_tx(x), m_ty(y), m_twidth(w), m_theight(h),
-										 m_visible(false), m_paused(false), m_state(EMPTY),
-										 m_text(0), m_bvh(0), m_name(0)
+										 m_visible(false), m_paused(false), m_poseDirty(false),
+										 m_timeline(false), m_scrubbing(false), m_state(EMPTY),
+										 m_detail(DETAIL_FULL), m_poseAge(0), m_poseInterval(0), m_posedFrame(-1), m_damage(SWAP_BUFFERS),
+										 m_pending(0), m_text(0), m_bvh(0), m_name(0),
+										 m_final(0), m_cursor(0), m_seek(0), m_chains(0)
 {
 	m_near = 0.1f;
 	m_far = 1000.f;
@@ -20,24 +25,77 @@ View::View(int x, int y, int w, int h) : m_x(x), m_y(y), m_width(w), m_height(h)
 }
 
 View::~View() {
+	deleteClip( m_pending.exchange(0) );
 }
 
-void View::setBVH(BVH* bvh, const char* name) {
-	if(m_bvh) {
-		delete m_bvh;
-		delete [] m_final;
-		if(m_name) free(m_name);
-		m_name = 0;
-	}
-	m_bvh = bvh;
-	m_frame = 0;
+// ------------------------------------------------- //
+
+View::Clip* View::createClip(BVH* bvh, const char* name) {
+	Clip* clip = new Clip;
+	clip->bvh = bvh;
+	clip->name = 0;
+	clip->final = clip->seek = 0;
+	clip->cursor = 0;
+	clip->chains = 0;
 	if(bvh) {
-		m_name = strdup(name);
-		m_final = new Transform[ m_bvh->getPartCount() ];
-		updateBones(0);
+		int parts = bvh->getPartCount();
+		clip->name = strdup(name? name: "");
+		clip->final = new Transform[parts];
+		clip->cursor = new int[parts];
+		memset(clip->cursor, 0, parts * sizeof(int));
+		clip->seek = new Transform[parts];
+		bvh->readFrames(0, 1, clip->seek);
+		applyPose(bvh, clip->seek, clip->final);
+		clip->chains = new short[parts];
+		findChains(bvh, clip->chains);
 	}
+	return clip;
+}
+
+void View::deleteClip(Clip* clip) {
+	if(!clip) return;
+	delete clip->bvh;
+	delete [] clip->final;
+	delete [] clip->cursor;
+	delete [] clip->seek;
+	delete [] clip->chains;
+	if(clip->name) free(clip->name);
+	delete clip;
+}
+
+void View::installClip(Clip* clip) {
+	TraceScope trace("installClip");
+	// Swap the arrays out so the old ones are freed with the clip
+	Clip old = { m_bvh, m_name, m_final, m_cursor, m_seek, m_chains };
+	m_bvh    = clip->bvh;
+	m_name   = clip->name;
+	m_final  = clip->final;
+	m_cursor = clip->cursor;
+	m_seek   = clip->seek;
+	m_chains = clip->chains;
+	*clip = old;
+	deleteClip(clip);
+	m_frame = 0;
+	m_poseDirty = false;
+	m_posedFrame = -1;
+	invalidate();
+}
+
+void View::setBVH(BVH* bvh, const char* name) {
+	installClip( createClip(bvh, name) );
+}
+
+void View::publish(BVH* bvh, const char* name) {
+	// Everything is built here, so update() only swaps pointers
+	TraceScope trace("createClip");
+	Clip* clip = createClip(bvh, name);
+	deleteClip( m_pending.exchange(clip, std::memory_order_acq_rel) );
 }
 
+View::Interpolation View::s_interpolation = View::SLERP;
+void View::setInterpolation(Interpolation mode) { s_interpolation = mode; }
+View::Interpolation View::getInterpolation() { return s_interpolation; }
+
 TTF_Font* staticFont = 0;
 void View::setFont(const char* fontName, int size) {
 	if(fontName) {
@@ -52,6 +110,7 @@ void View::setText(const char* text) {
 	if(!staticFont) text = 0;
 	if(text == 0 && m_text == 0) glDeleteTextures(1, &m_text);
 	else if(text) {
+		ProfileScope profile(PROFILE_TEXT);
 		if(!m_text) glGenTextures(1, &m_text);
 		glBindTexture(GL_TEXTURE_2D, m_text);
 
@@ -66,9 +125,11 @@ void View::setText(const char* text) {
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		SDL_FreeSurface(s);
 	}
+	invalidate();
 }
 
 void View::setVisible(bool v) {
+	if(v && !m_visible) invalidate();
 	m_visible = v;
 }
 
@@ -96,9 +157,10 @@ void View::move(int x, int y) {
 	m_y += y;
 	m_tx += x;
 	m_ty += y;
+	invalidate();
 }
 
-bool View::contains(int x, int y) {
+bool View::contains(int x, int y) const {
 	return m_visible && x>=m_x && y>=m_y && x <= m_x+m_width && y <= m_y+m_height;
 }
 
@@ -158,13 +220,12 @@ void View::autoZoom() {
 	n[3] = vec3(m[3]-m[1], m[7]-m[5], m[11]-m[9]);
 	for(int i=0; i<4; ++i) d[i] = n[i].dot(m_camera);
 
-	// Zoom out to fit points
+	// Zoom out to fit the corners of the clip bounds
 	float shift = 0;
-	for(int i=0; i<m_bvh->getPartCount(); ++i) {
-		shift += zoomToFit( m_final[i].offset, dir, n, d);
-	}
-	for(int i=0; i<m_bvh->getFrames(); ++i) {
-		shift += zoomToFit(m_bvh->getPart(0)->motion[i].offset, dir, n, d);
+	BVH::Bounds b = m_bvh->getBounds();
+	for(int i=0; i<8; ++i) {
+		vec3 corner(i&1? b.max.x: b.min.x, i&2? b.max.y: b.min.y, i&4? b.max.z: b.min.z);
+		shift += zoomToFit(corner, dir, n, d);
 	}
 	if(shift == 0) m_camera = m_target - dir;
 	updateCamera();
@@ -177,9 +238,24 @@ void View::togglePause() {
 void View::setState(State s) { m_state = s; }
 View::State View::getState() const { return m_state; }
 
+bool View::isAnimating() const {
+	if(m_state == QUEUED || m_state == LOADING || m_pending.load(std::memory_order_relaxed)) return true;
+	return isMoving() || (m_bvh && m_visible && !m_paused && !m_scrubbing && m_bvh->getFrames() > 1);
+}
+
 
 void View::update(float time) {
-	if(m_tx != m_x || m_twidth != m_width) {
+	if(m_pending.load(std::memory_order_relaxed)) {
+		Clip* clip = m_pending.exchange(0, std::memory_order_acquire);
+		if(clip) {
+			bool loaded = clip->bvh;
+			installClip(clip);
+			if(loaded) autoZoom();
+			setState(loaded? LOADED: INVALID);
+		}
+	}
+
+	if(isMoving()) {
 		const float speed = 8000 * time;
 		int dx = m_tx - m_x;
 		int dy = m_ty - m_y;
@@ -200,15 +276,84 @@ void View::update(float time) {
 		updateProjection();
 	}
 	
-	if(m_bvh && !m_paused && m_visible) {
+	// Small views are drawn with less detail
+	int size = m_width < m_height? m_width: m_height;
+	Detail detail = size >= 192? DETAIL_FULL: size >= 96? DETAIL_SOLID: DETAIL_LINES;
+	if(detail != m_detail) invalidate();
+	m_detail = detail;
+	m_poseAge += time;
+
+	if(m_bvh && !m_paused && !m_scrubbing && m_visible) {
 		m_frame += time / m_bvh->getFrameTime();
-		if(m_frame > m_bvh->getFrames()) m_frame = 0;
-		updateBones(m_frame);
+		// A clip still streaming in holds on its last decoded frame rather than looping early
+		int playable = m_bvh->getPlayableFrames();
+		if(playable < m_bvh->getFrames() && m_frame > playable - 1) m_frame = playable > 0? playable - 1: 0;
+		else if(m_frame > m_bvh->getFrames()) m_frame = 0;
+		// Skip posing when the view would not change. Small views show whole frames only
+		float shown = m_detail == DETAIL_FULL? m_frame: floor(m_frame);
+		if(m_poseAge >= m_poseInterval && shown != m_posedFrame) {
+			m_poseDirty = true;
+			m_poseAge = 0;
+			m_posedFrame = shown;
+		}
 	}
 }
 
+/** Evaluate the skeleton for the frame set by update(). Views are independent, so this may run on any thread */
+void View::updatePose() {
+	if(m_poseDirty && m_bvh) {
+		if(m_scrubbing) {
+			// Read just this frame rather than decoding the blocks we pass over
+			m_bvh->readFrames((int)m_frame, 1, m_seek);
+			applyPose(m_seek);
+		}
+		else {
+			int frame = (int)m_frame;
+			int next = frame + 1 < m_bvh->getFrames()? frame + 1: frame;
+			m_bvh->decodeFrames(frame, 2);
+			if(m_bvh->isDecoded(frame) && m_bvh->isDecoded(next)) updateBones(m_frame);
+			else {
+				// Another thread is still decoding this block
+				m_bvh->readFrames(frame, 1, m_seek);
+				applyPose(m_seek);
+			}
+		}
+		invalidate();
+	}
+	m_poseDirty = false;
+}
+
+// ------------------------------------------------- //
+
+static const int timelineHeight = 12;
+
+void View::setTimeline(bool show) {
+	m_timeline = show;
+	if(!show) m_scrubbing = false;
+	invalidate();
+}
+
+bool View::timelineContains(int x, int y) const {
+	return m_timeline && m_bvh && contains(x, y) && y < m_y + timelineHeight;
+}
+
+void View::scrub(int x) {
+	if(!m_bvh) return;
+	float t = (float)(x - m_x) / m_width;
+	if(t < 0) t = 0;
+	if(t > 1) t = 1;
+	m_frame = floor(t * (m_bvh->getFrames() - 1));
+	m_scrubbing = true;
+	m_poseDirty = true;
+}
+
+void View::endScrub() {
+	m_scrubbing = false;
+}
+
 void View::render() const {
 	if(!m_visible) return;
+	if(m_damage > 0) --m_damage;
 	glViewport(m_x, m_y, m_width, m_height);
 	glMatrixMode(GL_PROJECTION);
 	glLoadMatrixf(m_projectionMatrix);
@@ -225,49 +370,13 @@ void View::render() const {
 	glPopMatrix();
 
 	// Draw skeleton
-	if(m_bvh) {
-		glEnable(GL_POLYGON_OFFSET_LINE);
-		glPolygonOffset(-1,-1);
-		float matrix[16];
-		for(int i=0; i<m_bvh->getPartCount(); ++i) {
-			m_final[i].toMatrix(matrix);
-
-			/*
-			const BVH::Part* part = m_bvh->getPart(i);
-			glPushMatrix();
-			glMultMatrixf(matrix);
-			glBegin(GL_LINES);
-			glVertex3f(0,0,0);
-			glVertex3fv(&part->end.x);
-			glEnd();
-			glPopMatrix();
-			*/
-
-
-			glPushMatrix();
-			glMultMatrixf(matrix);
-
-			// Rotate to use z axis mesh
-			const vec3 zAxis(0,0,1);
-			vec3 dir = m_bvh->getPart(i)->end;
-			float length = dir.length();
-			dir *= 1.0 / length;
-			if(dir.z < 0.999) {
-				vec3 n = dir.cross(zAxis);
-				float d = dir.dot(zAxis);
-				glRotatef( -acos(d) * 180/3.141592653592, n.x, n.y, n.z );
-			}
-			glScalef(length, length, length);
-
-			// Draw bone mesh
-			glPolygonMode(GL_FRONT, GL_LINE);
-			glColor4f(0.2, 0, 0.5, 1);
-			drawBone();
-			glPolygonMode(GL_FRONT, GL_FILL);
-			glColor4f(0.5, 0, 1, 1);
-			drawBone();
-			glPopMatrix();
-		}
+	// Bounds only cover decoded blocks, and a pose read while scrubbing a lazy clip may lie outside them
+	BVH::Bounds bounds;
+	bool cull = m_bvh && m_bvh->isDecoded((int)m_frame);
+	if(cull) bounds = m_bvh->getBounds((int)m_frame);
+	if(m_bvh && (!cull || inFrustum(bounds.centre, bounds.radius))) {
+		if(m_detail == DETAIL_LINES) drawLines();
+		else drawBones(m_detail == DETAIL_FULL);
 	}
 
 	// Border?
@@ -279,6 +388,21 @@ void View::render() const {
 	glVertexPointer(2, GL_FLOAT, 0, border);
 	glDrawArrays(GL_LINE_STRIP, 0, 5);
 
+	// Timeline
+	if(m_timeline && m_bvh) {
+		float h = timelineHeight * 2.0 / m_height - 1;
+		int frames = m_bvh->getFrames();
+		float p = frames > 1? m_frame / (frames - 1) * 2 - 1: -1;
+		float bar[] = { -1,-1, -1,h, 1,-1, 1,h };
+		float head[] = { p,-1, p,h };
+		glColor4f(0.15, 0.15, 0.15, 1);
+		glVertexPointer(2, GL_FLOAT, 0, bar);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		glColor4f(1, 1, 1, 1);
+		glVertexPointer(2, GL_FLOAT, 0, head);
+		glDrawArrays(GL_LINES, 0, 2);
+	}
+
 	// Text
 	if(m_text) {
 		glEnable(GL_TEXTURE_2D);
@@ -305,29 +429,168 @@ void View::render() const {
 
 // ------------------------------------------------- //
 
-void View::updateBones(float frame) {
-	int f = floor(frame);
-	float t = frame - f;
+/** Rotate the z axis bone mesh to point along dir, and scale it to its length */
+void View::alignBone(const vec3& dir) {
+	const vec3 zAxis(0,0,1);
+	float length = dir.length();
+	vec3 n = dir * (1.0 / length);
+	if(n.z < 0.999) {
+		vec3 axis = n.cross(zAxis);
+		float d = n.dot(zAxis);
+		glRotatef( -acos(d) * 180/3.141592653592, axis.x, axis.y, axis.z );
+	}
+	glScalef(length, length, length);
+}
+
+vec3 View::boneEnd(int part) const {
+	return m_final[part].offset + m_final[part].rotation * m_bvh->getPart(part)->end;
+}
+
+void View::drawBones(bool wireframe) const {
+	glEnable(GL_POLYGON_OFFSET_LINE);
+	glPolygonOffset(-1,-1);
+	float matrix[16];
+	for(int i=0; i<m_bvh->getPartCount(); ++i) {
+		glPushMatrix();
+		if(wireframe || m_chains[i] == CHAIN_NONE) {
+			m_final[i].toMatrix(matrix);
+			glMultMatrixf(matrix);
+			alignBone(m_bvh->getPart(i)->end);
+		}
+		else if(m_chains[i] == CHAIN_HIDDEN) {
+			glPopMatrix();
+			continue;
+		}
+		else {
+			// One bone from the start of the chain to the end of its tip
+			const vec3& start = m_final[i].offset;
+			glTranslatef(start.x, start.y, start.z);
+			alignBone(boneEnd(m_chains[i]) - start);
+		}
+
+		// Draw bone mesh
+		if(wireframe) {
+			glPolygonMode(GL_FRONT, GL_LINE);
+			glColor4f(0.2, 0, 0.5, 1);
+			drawBone();
+			glPolygonMode(GL_FRONT, GL_FILL);
+		}
+		glColor4f(0.5, 0, 1, 1);
+		drawBone();
+		glPopMatrix();
+	}
+}
 
-	if(f >= m_bvh->getFrames()-1) {
-		f = m_bvh->getFrames()-1;
-		t = 0.f;
+void View::drawLines() const {
+	// Only drawn from the render thread
+	static std::vector<vec3> lines;
+	lines.clear();
+	for(int i=0; i<m_bvh->getPartCount(); ++i) {
+		if(m_chains[i] == CHAIN_HIDDEN) continue;
+		lines.push_back( m_final[i].offset );
+		lines.push_back( boneEnd(m_chains[i] == CHAIN_NONE? i: m_chains[i]) );
+	}
+	glColor4f(0.5, 0, 1, 1);
+	glVertexPointer(3, GL_FLOAT, sizeof(vec3), &lines[0].x);
+	glDrawArrays(GL_LINES, 0, lines.size());
+}
+
+/** Find short chains at the ends of the skeleton, such as fingers and toes, that small
+ * views draw as a single bone */
+void View::findChains(const BVH* bvh, short* chains) {
+	int parts = bvh->getPartCount();
+	int* children = new int[parts];
+	int* child = new int[parts];
+	float* reach = new float[parts];	// Distance from the root
+	float* length = new float[parts];	// Length of the unbranched chain below each part, or -1
+	float size = 0;
+	for(int i=0; i<parts; ++i) {
+		const BVH::Part* part = bvh->getPart(i);
+		int parent = bvh->getParent(i);
+		children[i] = 0;
+		reach[i] = parent < 0? 0: reach[parent] + part->offset.length();
+		if(reach[i] > size) size = reach[i];
+		if(parent >= 0) {
+			++children[parent];
+			child[parent] = i;
+		}
+	}
+	// Children always follow their parent
+	for(int i=parts-1; i>=0; --i) {
+		if(children[i] == 0) length[i] = bvh->getPart(i)->end.length();
+		else if(children[i] == 1 && length[ child[i] ] >= 0) length[i] = bvh->getPart(child[i])->offset.length() + length[ child[i] ];
+		else length[i] = -1;
 	}
+	float limit = size * 0.15f;
+	for(int i=0; i<parts; ++i) chains[i] = CHAIN_NONE;
+	for(int i=0; i<parts; ++i) {
+		int parent = bvh->getParent(i);
+		bool start = children[i] == 1 && length[i] >= 0 && length[i] < limit;
+		if(!start || (parent >= 0 && length[parent] >= 0 && length[parent] < limit)) continue;
+		int tip = i;
+		while(children[tip]) {
+			tip = child[tip];
+			chains[tip] = CHAIN_HIDDEN;
+		}
+		chains[i] = tip;
+	}
+	delete [] children;
+	delete [] child;
+	delete [] reach;
+	delete [] length;
+}
 
-	Transform local;
+bool View::inFrustum(const vec3& centre, float radius) const {
+	float m[16];
+	multMatrix(m_projectionMatrix, m_viewMatrix, m);
+	vec3 p = centre - m_camera;
+	for(int i=0; i<3; ++i) {
+		for(int s=-1; s<=1; s+=2) {
+			// Plane is row 3 +/- row i
+			vec3 n(m[3]+s*m[i], m[7]+s*m[4+i], m[11]+s*m[8+i]);
+			float w = m[15] + s*m[12+i];
+			float l = n.length();
+			if(l > 0 && (n.dot(p) + w) / l < -radius) return false;
+		}
+	}
+	return true;
+}
+
+void View::updateBones(float frame) {
+	Quaternion (*interpolate)(const Quaternion&, const Quaternion&, float);
+	switch(s_interpolation) {
+	case NLERP:      interpolate = nlerp; break;
+	case FAST_SLERP: interpolate = fastSlerp; break;
+	default:         interpolate = slerp; break;
+	}
+
+	Transform local, next;
 	for(int i=0; i<m_bvh->getPartCount(); ++i) {
 		const BVH::Part* part = m_bvh->getPart(i);
 
+		// Constant chains only need placing relative to the nearest moving ancestor
+		if(part->constant) {
+			if(part->anchor < 0) m_final[i] = part->relative;
+			else {
+				const Transform& anchor = m_final[part->anchor];
+				m_final[i].offset   = anchor.offset + anchor.rotation * part->relative.offset;
+				m_final[i].rotation = anchor.rotation * part->relative.rotation;
+			}
+			continue;
+		}
+
+		float t = m_bvh->findKey(i, frame, m_cursor[i]);
+		m_bvh->getKey(i, m_cursor[i], local);
 		if(t > 0) {
-			local.offset = lerp(part->motion[f].offset, part->motion[f+1].offset, t);
-			local.rotation = slerp(part->motion[f].rotation, part->motion[f+1].rotation, t);
-		} else {
-			local = part->motion[f];
+			m_bvh->getKey(i, m_cursor[i]+1, next);
+			local.offset = lerp(local.offset, next.offset, t);
+			local.rotation = interpolate(local.rotation, next.rotation, t);
 		}
 
-		if(part->parent>=0) {
+		int p = m_bvh->getParent(i);
+		if(p>=0) {
 			local.offset = part->offset; // ?
-			const Transform& parent = m_final[part->parent];
+			const Transform& parent = m_final[p];
 			m_final[i].offset   = parent.offset + parent.rotation * local.offset;
 			m_final[i].rotation = parent.rotation * local.rotation;
 		} else {
@@ -337,6 +600,14 @@ void View::updateBones(float frame) {
 }
 
 
+void View::applyPose(const Transform* local) {
+	applyPose(m_bvh, local, m_final);
+}
+void View::applyPose(const BVH* bvh, const Transform* local, Transform* final) {
+	bvh->getWorldPose(local, final);
+}
+
+
 // ------------------------------------------------- //
 
 void View::updateCamera() {
@@ -354,6 +625,7 @@ void View::updateCamera() {
 	m[1] = y.x; m[5] = y.y; m[9]  = y.z;
 	m[2] = z.x; m[6] = z.y; m[10] = z.z;
 	m[12] = 0; m[13] = 0; m[14] = 0; m[15] = 1;
+	invalidate();
 }
 
 void View::updateProjection(float fov) {
@@ -367,6 +639,7 @@ void View::updateProjection(float fov) {
 	m[10] = (m_far + m_near) / (m_near - m_far);
 	m[11] = -1.f;
 	m[14] = (2.f * m_far * m_near) / (m_near - m_far);
+	invalidate();
 }
 
 void View::drawGrid() {
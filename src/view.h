@@ -3,21 +3,33 @@
 
 #include "transform.h"
 #include "bvh.h"
+#include <atomic>
 
 /** Single bvh view */
 class View {
 	public:
 	enum State { EMPTY, QUEUED, LOADING, LOADED, INVALID };
+	enum Interpolation { SLERP, NLERP, FAST_SLERP };
+	/** How much of the skeleton is drawn, chosen from the on-screen size.
+	 * Smaller levels collapse short leaf chains such as fingers and skip the wireframe pass */
+	enum Detail { DETAIL_FULL, DETAIL_SOLID, DETAIL_LINES };
+	/** Back buffers that may still hold an old picture of a view. Swaps are assumed to exchange two */
+	enum { SWAP_BUFFERS = 2 };
 
 	View(int x, int y, int w, int h);
 	~View();
 
 	void setBVH(BVH*, const char* name=0);
+	/** Hand a loaded clip over from another thread. The view takes ownership and
+	 * installs it, zoomed to fit, on the next update() */
+	void publish(BVH*, const char* name);
 	void resize(int x, int y, int w, int h, bool smooth=false);
 	void move(int x, int y);
-	bool contains(int mx, int my);
+	bool contains(int mx, int my) const;
 	int top() const					{ return m_y; }
 	int bottom() const				{ return m_y + m_height; }
+	void getRect(int& x, int& y, int& w, int& h) const { x=m_x; y=m_y; w=m_width; h=m_height; }
+	bool isMoving() const			{ return m_tx != m_x || m_ty != m_y || m_twidth != m_width || m_theight != m_height; }
 
 	void setCamera(float yaw, float pitch, float zoom);
 	void rotateView(float yaw, float pitch);
@@ -29,14 +41,34 @@ class View {
 
 	void render() const;
 	void update(float time);
+	void updatePose();
 	void togglePause();
 
+	/** Mark the view as changed, so it is drawn again into every back buffer */
+	void invalidate()				{ m_damage = SWAP_BUFFERS; }
+	/** True if the view changed since it was last drawn into one of the buffers */
+	bool needsRedraw() const		{ return m_damage > 0; }
+	/** True while update() can change the view without any input */
+	bool isAnimating() const;
+
+	Detail getDetail() const        { return m_detail; }
+	/** Minimum seconds between pose evaluations, set by the UpdateScheduler */
+	void setPoseInterval(float seconds)	{ m_poseInterval = seconds; }
+
+	void setTimeline(bool show);
+	bool timelineContains(int mx, int my) const;
+	void scrub(int mx);
+	void endScrub();
+
 	State getState() const;
 	void setState(State);
 
 	void setText(const char* text);
 	static void setFont(const char* font, int size=24);
 
+	static void setInterpolation(Interpolation);
+	static Interpolation getInterpolation();
+
 	protected:
 	int m_x, m_y, m_width, m_height;
 	int m_tx, m_ty, m_twidth, m_theight;
@@ -44,7 +76,26 @@ class View {
 	char  m_title[128];
 	bool  m_visible;
 	bool  m_paused;
-	State m_state;
+	bool  m_poseDirty;
+	bool  m_timeline;
+	bool  m_scrubbing;
+	std::atomic<State> m_state;
+	Detail m_detail;
+	float  m_poseAge;		// Seconds since the pose was last evaluated
+	float  m_poseInterval;	// Minimum seconds between evaluations
+	float  m_posedFrame;	// Frame the current pose shows, or -1
+	mutable int m_damage;	// Frames until every buffer shows the current state
+
+	/** Everything a loaded clip needs, built before the render thread sees it */
+	struct Clip {
+		BVH*       bvh;
+		char*      name;
+		Transform* final;
+		int*       cursor;
+		Transform* seek;
+		short*     chains;
+	};
+	std::atomic<Clip*> m_pending;	// Published by the loader, taken by update()
 
 	unsigned   m_text;
 	int        m_textWidth;
@@ -53,6 +104,9 @@ class View {
 	BVH*       m_bvh;
 	char*      m_name;
 	Transform* m_final;
+	int*       m_cursor;	// Last key segment of each part
+	Transform* m_seek;		// Local transforms read while scrubbing
+	short*     m_chains;	// Tip part of the collapsed chain each part starts, or CHAIN_NONE / CHAIN_HIDDEN
 	float      m_frame;
 
 	float m_projectionMatrix[16];
@@ -61,13 +115,27 @@ class View {
 	vec3  m_camera;
 	vec3  m_target;
 
+	static Interpolation s_interpolation;
+
 	protected:
 	void updateBones(float frame);
+	void applyPose(const Transform* local);
+	static void applyPose(const BVH*, const Transform* local, Transform* final);
+	static Clip* createClip(BVH*, const char* name);
+	void installClip(Clip*);
+	static void deleteClip(Clip*);
 	void updateCamera();
 	void updateProjection(float fov=90);
 	float zoomToFit(const vec3& point, const vec3& dir, const vec3* n, float* d);
+	bool  inFrustum(const vec3& centre, float radius) const;
 	static void drawGrid();
 	static void drawBone();
+	static void alignBone(const vec3& dir);
+	void drawBones(bool wireframe) const;
+	void drawLines() const;
+	vec3 boneEnd(int part) const;
+	static void findChains(const BVH*, short* chains);
+	enum { CHAIN_NONE = -1, CHAIN_HIDDEN = -2 };
 
 };
 
@@ -0,0 +1,246 @@
+#include "zip.h"
+#include "trace.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "miniz.c"
+
+static inline unsigned readU16(const unsigned char* p) { return p[0] | p[1]<<8; }
+static inline unsigned readU32(const unsigned char* p) { return p[0] | p[1]<<8 | p[2]<<16 | (unsigned)p[3]<<24; }
+static inline unsigned long long readU64(const unsigned char* p) { return readU32(p) | (unsigned long long)readU32(p+4)<<32; }
+
+// ------------------------------------------------- //
+
+ZipArchive::ZipArchive() : m_directory(0) {
+	#ifdef WIN32
+	m_file = INVALID_HANDLE_VALUE;
+	#else
+	m_file = -1;
+	#endif
+}
+
+ZipArchive::~ZipArchive() {
+	close();
+}
+
+void ZipArchive::close() {
+	#ifdef WIN32
+	if(m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+	m_file = INVALID_HANDLE_VALUE;
+	#else
+	if(m_file >= 0) ::close(m_file);
+	m_file = -1;
+	#endif
+	m_entries.clear();
+	delete [] m_directory;
+	m_directory = 0;
+}
+
+bool ZipArchive::open(const char* file, const char* suffix) {
+	close();
+	#ifdef WIN32
+	m_file = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if(m_file == INVALID_HANDLE_VALUE) return false;
+	#else
+	m_file = ::open(file, O_RDONLY);
+	if(m_file < 0) return false;
+	#endif
+	m_path = file;
+	if(readDirectory(suffix)) return true;
+	close();
+	return false;
+}
+
+bool ZipArchive::readDirectory(const char* suffix) {
+	// The end of central directory record is in the last 64k, after any comment
+	unsigned long long fileSize;
+	#ifdef WIN32
+	LARGE_INTEGER li;
+	if(!GetFileSizeEx(m_file, &li)) return false;
+	fileSize = li.QuadPart;
+	#else
+	off_t end = lseek(m_file, 0, SEEK_END);
+	if(end < 0) return false;
+	fileSize = end;
+	#endif
+	if(fileSize < 22) return false;
+	size_t tailSize = fileSize < 65557? fileSize: 65557;
+	unsigned char* tail = new unsigned char[tailSize];
+	unsigned long long tailOffset = fileSize - tailSize;
+	if(!readAt(tail, tailSize, tailOffset)) { delete [] tail; return false; }
+	int eocd = -1;
+	for(int i=tailSize-22; i>=0; --i) {
+		if(readU32(tail+i) == 0x06054b50) { eocd = i; break; }
+	}
+	if(eocd < 0) { delete [] tail; return false; }
+	unsigned long long count = readU16(tail + eocd + 10);
+	unsigned long long dirSize = readU32(tail + eocd + 12);
+	unsigned long long dirOffset = readU32(tail + eocd + 16);
+
+	// Zip64 archives keep the real values in another record, found through a locator
+	if(eocd >= 20 && readU32(tail + eocd - 20) == 0x07064b50) {
+		unsigned char record[56];
+		if(!readAt(record, 56, readU64(tail + eocd - 12)) || readU32(record) != 0x06064b50) { delete [] tail; return false; }
+		count = readU64(record + 32);
+		dirSize = readU64(record + 40);
+		dirOffset = readU64(record + 48);
+	}
+	delete [] tail;
+	if(dirOffset + dirSize > fileSize) return false;
+
+	m_directory = new char[dirSize + 1];
+	if(!readAt(m_directory, dirSize, dirOffset)) return false;
+	m_directory[dirSize] = 0;
+
+	// Walk the records in place. Nothing is copied for entries the suffix rejects
+	size_t suffixLength = suffix? strlen(suffix): 0;
+	const unsigned char* p = (const unsigned char*)m_directory;
+	const unsigned char* dirEnd = p + dirSize;
+	char* terminate = 0;
+	m_entries.reserve(suffix? 0: count);
+	for(unsigned long long i=0; i<count; ++i) {
+		if(p + 46 > dirEnd || readU32(p) != 0x02014b50) return false;
+		unsigned nameLength = readU16(p + 28);
+		unsigned extraLength = readU16(p + 30);
+		unsigned commentLength = readU16(p + 32);
+		const unsigned char* name = p + 46;
+		const unsigned char* next = name + nameLength + extraLength + commentLength;
+		if(next > dirEnd) return false;
+
+		// The previous name ends where this record may begin, so only terminate it now
+		if(terminate) *terminate = 0;
+		terminate = 0;
+
+		bool keep = !suffix || (nameLength >= suffixLength && memcmp(name + nameLength - suffixLength, suffix, suffixLength) == 0);
+		if(keep) {
+			Entry e;
+			e.method = readU16(p + 10);
+			e.crc = readU32(p + 16);
+			e.compressedSize = readU32(p + 20);
+			e.size = readU32(p + 24);
+			e.headerOffset = readU32(p + 42);
+			e.name = name - (const unsigned char*)m_directory;
+
+			// Sizes that do not fit in 32 bits are in the zip64 extra field, in this order
+			const unsigned char* extra = name + nameLength;
+			const unsigned char* extraEnd = extra + extraLength;
+			while(extra + 4 <= extraEnd) {
+				unsigned id = readU16(extra);
+				unsigned length = readU16(extra + 2);
+				const unsigned char* field = extra + 4;
+				if(id == 0x0001) {
+					const unsigned char* fieldEnd = field + length;
+					if(e.size == 0xffffffff && field + 8 <= fieldEnd)           { e.size = readU64(field); field += 8; }
+					if(e.compressedSize == 0xffffffff && field + 8 <= fieldEnd) { e.compressedSize = readU64(field); field += 8; }
+					if(e.headerOffset == 0xffffffff && field + 8 <= fieldEnd)   { e.headerOffset = readU64(field); field += 8; }
+					break;
+				}
+				extra = field + length;
+			}
+			m_entries.push_back(e);
+			terminate = (char*)name + nameLength;
+		}
+		p = next;
+	}
+	if(terminate) *terminate = 0;
+	return true;
+}
+
+bool ZipArchive::readAt(void* buffer, size_t length, unsigned long long offset) const {
+	#ifdef WIN32
+	OVERLAPPED overlapped;
+	memset(&overlapped, 0, sizeof(overlapped));
+	overlapped.Offset = (DWORD)offset;
+	overlapped.OffsetHigh = (DWORD)((unsigned long long)offset >> 32);
+	DWORD read = 0;
+	return ReadFile(m_file, buffer, length, &read, &overlapped) && read == length;
+	#else
+	char* out = (char*)buffer;
+	while(length > 0) {
+		ssize_t r = pread(m_file, out, length, offset);
+		if(r <= 0) return false;
+		out += r;
+		offset += r;
+		length -= r;
+	}
+	return true;
+	#endif
+}
+
+char* ZipArchive::extract(int index, size_t* size, size_t limit) const {
+	if(index < 0 || index >= (int)m_entries.size()) return 0;
+	TraceScope trace("inflate");
+	const Entry& e = m_entries[index];
+	if(e.method != 0 && e.method != MZ_DEFLATED) return 0;
+
+	// Compressed data follows the local header, whose name and extra field lengths
+	// may differ from the central directory
+	unsigned char header[30];
+	if(!readAt(header, 30, e.headerOffset) || readU32(header) != 0x04034b50) return 0;
+	unsigned long long dataOffset = e.headerOffset + 30 + readU16(header + 26) + readU16(header + 28);
+
+	bool partial = limit > 0 && limit < e.size;
+	size_t length = partial? limit: e.size;
+	char* out = (char*)malloc(length + 1);
+	if(!out) return 0;
+	bool ok;
+	if(e.method == 0) {
+		ok = e.compressedSize == e.size && readAt(out, length, dataOffset);
+	}
+	else {
+		// Deflated data is almost never larger than its output, so reading as many
+		// bytes as we want out is enough for a partial extract
+		size_t packedSize = e.compressedSize;
+		if(partial && length < packedSize) packedSize = length;
+		unsigned char* packed = (unsigned char*)malloc(packedSize);
+		ok = packed && readAt(packed, packedSize, dataOffset);
+		if(ok) {
+			// Each thread inflates with its own decompressor
+			static thread_local tinfl_decompressor inflator;
+			tinfl_init(&inflator);
+			size_t inSize = packedSize;
+			size_t outSize = length;
+			int flags = TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF;
+			if(packedSize < e.compressedSize) flags |= TINFL_FLAG_HAS_MORE_INPUT;
+			tinfl_status status = tinfl_decompress(&inflator, packed, &inSize, (mz_uint8*)out, (mz_uint8*)out, &outSize, flags);
+			if(partial) {
+				ok = status >= 0;
+				length = outSize;
+			}
+			else ok = status == TINFL_STATUS_DONE && outSize == e.size;
+		}
+		free(packed);
+	}
+	if(ok && !partial) ok = mz_crc32(MZ_CRC32_INIT, (const mz_uint8*)out, e.size) == e.crc;
+	if(!ok) {
+		printf("Failed to extract %s from %s\n", getName(index), m_path.c_str());
+		free(out);
+		return 0;
+	}
+	out[length] = 0;
+	if(size) *size = length;
+	return out;
+}
+
+bool ZipArchive::extractToFile(int index, const char* file) const {
+	size_t size;
+	char* data = extract(index, &size);
+	if(!data) return false;
+	FILE* fp = fopen(file, "wb");
+	if(fp) {
+		fwrite(data, 1, size, fp);
+		fclose(fp);
+	}
+	free(data);
+	return fp;
+}
+
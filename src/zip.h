@@ -0,0 +1,57 @@
+#ifndef _ZIP_
+#define _ZIP_
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+/** Read only zip archive.
+ * The file stays open and entries are read with positioned reads, so any number
+ * of threads may extract from the same archive at once. */
+class ZipArchive {
+	public:
+	struct Entry {
+		unsigned long long headerOffset;	// Local file header
+		unsigned long long compressedSize;
+		unsigned long long size;
+		unsigned crc;
+		unsigned name;						// Offset of the name in the directory buffer
+		unsigned short method;				// 0 stored, 8 deflate
+	};
+
+	ZipArchive();
+	~ZipArchive();
+
+	/** Open an archive and scan its central directory
+	 * @param suffix Only keep entries whose names end with this, if set */
+	bool open(const char* file, const char* suffix=0);
+	void close();
+
+	const char* path() const                 { return m_path.c_str(); }
+	int getEntryCount() const                { return m_entries.size(); }
+	const Entry& getEntry(int index) const   { return m_entries[index]; }
+	const char* getName(int index) const     { return m_directory + m_entries[index].name; }
+
+	/** Extract an entry into a null terminated malloc buffer. Safe to call from any thread
+	 * @param size  Set to the number of bytes extracted, excluding the terminator
+	 * @param limit Only extract the start of the entry, if non-zero */
+	char* extract(int index, size_t* size=0, size_t limit=0) const;
+	/** Extract an entry and write it to a file */
+	bool extractToFile(int index, const char* file) const;
+
+	protected:
+	bool readAt(void* buffer, size_t length, unsigned long long offset) const;
+	bool readDirectory(const char* suffix);
+
+	std::string        m_path;
+	std::vector<Entry> m_entries;
+	char*              m_directory;	// Raw central directory. Names are terminated in place
+	#ifdef WIN32
+	void*              m_file;
+	#else
+	int                m_file;
+	#endif
+};
+
+#endif
+